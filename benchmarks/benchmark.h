@@ -0,0 +1,71 @@
+#ifndef cragsman_benchmark_h_h4j5k6l7
+#define cragsman_benchmark_h_h4j5k6l7
+
+#include "common.h"
+
+#include <cage-core/logger.h>
+
+#include <chrono>
+
+// all benchmarks generate the same terrain
+constexpr uint32 BenchmarkSeed = 42;
+
+struct BenchmarkResult
+{
+	uint64 calls = 0;
+	uint64 nanoseconds = 0;
+	double checksum = 0;
+
+	double nsPerCall() const
+	{
+		return calls ? (double)nanoseconds / calls : 0;
+	}
+
+	double callsPerSecond() const
+	{
+		return nanoseconds ? calls * 1e9 / nanoseconds : 0;
+	}
+};
+
+inline void benchmarkReport(const String &name, const BenchmarkResult &r)
+{
+	CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + name + ": " + r.nsPerCall() + " ns/call, " + r.callsPerSecond() + " calls/s, checksum: " + r.checksum);
+}
+
+// calls the function for every sample, repeatedly, and sums its results into the checksum
+template<class Sample, class Function>
+BenchmarkResult benchmarkSamples(PointerRange<const Sample> samples, uint32 repeats, Function &&function)
+{
+	BenchmarkResult r;
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32 i = 0; i < repeats; i++)
+		for (const Sample &s : samples)
+			r.checksum += function(s);
+	const auto end = std::chrono::steady_clock::now();
+	r.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	r.calls = (uint64)samples.size() * repeats;
+	return r;
+}
+
+// calls the function, which processes the given number of items at once and returns a checksum of its results
+template<class Function>
+BenchmarkResult benchmarkBatch(uint64 items, uint32 repeats, Function &&function)
+{
+	BenchmarkResult r;
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32 i = 0; i < repeats; i++)
+		r.checksum += function();
+	const auto end = std::chrono::steady_clock::now();
+	r.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	r.calls = items * repeats;
+	return r;
+}
+
+void benchmarkTerrainOffset();
+void benchmarkTerrainMaterial();
+void benchmarkTerrainGenerator();
+void benchmarkProcedural();
+void benchmarkPhysics();
+void benchmarkParticles();
+
+#endif // !cragsman_benchmark_h_h4j5k6l7
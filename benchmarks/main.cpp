@@ -0,0 +1,24 @@
+#include "benchmark.h"
+
+int main(int argc, const char *args[])
+{
+	try
+	{
+		Holder<Logger> log1 = newLogger();
+		log1->format.bind<logFormatConsole>();
+		log1->output.bind<logOutputStdOut>();
+
+		benchmarkTerrainOffset();
+		benchmarkTerrainMaterial();
+		benchmarkTerrainGenerator();
+		benchmarkProcedural();
+		benchmarkPhysics();
+		benchmarkParticles();
+		return 0;
+	}
+	catch (...)
+	{
+		detail::logCurrentCaughtException();
+	}
+	return 1;
+}
@@ -0,0 +1,77 @@
+#include "benchmark.h"
+#include "particles.h"
+
+#include <cage-core/random.h>
+
+namespace
+{
+	constexpr uint32 FramesCount = 1000;
+	constexpr Real FrameDuration = 1.0 / 30;
+
+	// spring visuals emit about this many particles every frame, each living for 6 updates
+	void benchmarkEmission(uint32 capacity, uint32 perFrame)
+	{
+		ParticlesPool pool(capacity);
+		RandomGenerator rg(BenchmarkSeed, perFrame);
+		BenchmarkResult r = benchmarkBatch(perFrame, FramesCount, [&]() {
+			for (uint32 i = 0; i < perFrame; i++)
+				pool.emit(Vec3(rg.randomChance(), rg.randomChance(), rg.randomChance()) * 100, rg.randomDirection3() * 5, Vec3(1), 5, rg.randomChance() < 0.2);
+			pool.update(FrameDuration);
+			return 0;
+		});
+		for (uint32 i = 0; i < pool.capacity(); i++)
+		{
+			if (pool.alive[i])
+				r.checksum += (pool.positions[i][0] + pool.positions[i][1] * 3 + pool.positions[i][2] * 7).value;
+		}
+		benchmarkReport(Stringizer() + "particles, capacity " + capacity + ", " + perFrame + " per frame, per particle", r);
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "particles, capacity " + capacity + ", " + perFrame + " per frame: " + (r.nanoseconds * 1e-3 / FramesCount) + " us per frame, alive: " + pool.aliveCount() + ", overwritten: " + pool.overwritten);
+	}
+
+	// particles along springs around the focus, like the arms of the character, with a fifth of them emitting light
+	void benchmarkLights(uint32 springs, uint32 budget, Real mergeDistance)
+	{
+		ParticlesPool pool(4096);
+		RandomGenerator rg(BenchmarkSeed, springs);
+		const Vec3 colors[3] = { Vec3(1, 1, 0), Vec3(0, 1, 1), Vec3(1, 0, 1) };
+		for (uint32 s = 0; s < springs; s++)
+		{
+			const Vec3 a = rg.randomDirection3() * 20;
+			const Vec3 b = a + rg.randomDirection3() * 10;
+			for (uint32 i = 0; i < 18; i++)
+				pool.emit(interpolate(a, b, rg.randomChance()) + rg.randomDirection3(), Vec3(), colors[s % 3], 5, rg.randomChance() < 0.2);
+		}
+		std::vector<ParticleLight> all, selected;
+		const uint32 candidates = pool.selectLights(Vec3(), m, mergeDistance, all);
+		BenchmarkResult r = benchmarkBatch(candidates, 100, [&]() {
+			pool.selectLights(Vec3(), budget, mergeDistance, selected);
+			return selected.size();
+		});
+		benchmarkReport(Stringizer() + "particles lights, " + springs + " springs, budget " + budget + ", per candidate", r);
+		if (selected.size() > budget)
+			CAGE_THROW_ERROR(Exception, "particle lights exceed the budget");
+		Real total = 0, kept = 0, totalImportance = 0, keptImportance = 0;
+		for (const ParticleLight &l : all)
+		{
+			total += l.intensity;
+			totalImportance += l.importance;
+		}
+		for (const ParticleLight &l : selected)
+		{
+			kept += l.intensity;
+			keptImportance += l.importance;
+		}
+		if (abs(total - candidates * pool.lightIntensity) > 1e-3 * total)
+			CAGE_THROW_ERROR(Exception, "merging particle lights changed the total intensity");
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "particles lights, " + springs + " springs: candidates: " + candidates + ", merged: " + all.size() + ", selected: " + selected.size() + ", kept intensity: " + (kept / total) + ", kept importance: " + (keptImportance / totalImportance));
+	}
+}
+
+void benchmarkParticles()
+{
+	for (uint32 perFrame : { 50, 200, 800 })
+		benchmarkEmission(2048, perFrame);
+	benchmarkEmission(16384, 2000);
+	for (uint32 springs : { 9, 30, 100 })
+		benchmarkLights(springs, 16, 3);
+}
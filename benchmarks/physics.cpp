@@ -0,0 +1,643 @@
+#include "benchmark.h"
+#include "physics.h"
+
+#include <cage-core/entities.h>
+#include <cage-core/collisionStructure.h>
+#include <cage-core/collider.h>
+#include <cage-core/random.h>
+
+#include <cage-engine/scene.h>
+
+#include <thread>
+#include <cmath>
+
+namespace
+{
+	constexpr uint32 ChainsCount = 64;
+	constexpr uint32 ChainLength = 32;
+	constexpr uint32 UpdatesCount = 30;
+	constexpr uint32 DriftUpdatesCount = 300;
+	constexpr uint32 RepeatSteps = 2; // default of the simulation
+	constexpr Real DeltaTime = 1.0 / 30 / RepeatSteps;
+	constexpr uint32 ScenarioUpdates = 20;
+	constexpr sint32 ScenarioTiles = 8; // the scenarios take place on a heightfield of 8 x 8 tiles
+	constexpr Real ScenarioSize = ScenarioTiles * 30;
+
+	// hanging chains, each attached to a static anchor, every other link collides with the terrain
+	Holder<EntityManager> makeScene(Real stiffness = 0.3, Real damping = 0.05, uint32 chainLength = ChainLength, Real height = 5)
+	{
+		Holder<EntityManager> ents = newEntityManager();
+		ents->defineComponent(TransformComponent());
+		ents->defineComponent(PhysicsComponent());
+		ents->defineComponent(SpringComponent());
+		for (uint32 c = 0; c < ChainsCount; c++)
+		{
+			const Vec2 base = Vec2(c * 3, 0);
+			Entity *prev = ents->createUnique();
+			prev->value<TransformComponent>().position = Vec3(base, terrainOffset(base) + height);
+			for (uint32 i = 0; i < chainLength; i++)
+			{
+				Entity *e = ents->createUnique();
+				const Vec2 p = base + Vec2(0, -Real(i + 1));
+				e->value<TransformComponent>().position = Vec3(p, terrainOffset(p) + height);
+				PhysicsComponent &ph = e->value<PhysicsComponent>();
+				ph.mass = sphereVolume(0.3);
+				ph.collisionRadius = i % 2 ? Real(0.3) : Real::Nan();
+				Entity *s = ents->createAnonymous();
+				SpringComponent &sc = s->value<SpringComponent>();
+				sc.objects[0] = prev->name();
+				sc.objects[1] = e->name();
+				sc.restDistance = 1;
+				sc.stiffness = stiffness;
+				sc.damping = damping;
+				prev = e;
+			}
+		}
+		return ents;
+	}
+
+	double checksum(EntityManager *ents)
+	{
+		double r = 0;
+		for (Entity *e : ents->component<PhysicsComponent>()->entities())
+		{
+			const Vec3 &p = e->value<TransformComponent>().position;
+			r += (p[0] + p[1] * 3 + p[2] * 7).value;
+		}
+		return r;
+	}
+
+	// boulders scattered with constant density, radii as in boulders.cpp
+	PhysicsBodies makeBoulders(uint32 count)
+	{
+		RandomGenerator rg(BenchmarkSeed, count);
+		const Real size = pow(Real(count), 1.0 / 3) * 6;
+		PhysicsBodies b;
+		for (uint32 i = 0; i < count; i++)
+		{
+			const Vec3 p = Vec3(rg.randomChance(), rg.randomChance(), rg.randomChance()) * size;
+			const Real r = rg.randomChance() + 1.5;
+			b.add(nullptr, p, Vec3(), 1 / (sphereVolume(r) * 0.5), r);
+		}
+		b.dynamicCount = b.size();
+		return b;
+	}
+
+	uint32 bruteForcePairs(const PhysicsBodies &b)
+	{
+		uint32 result = 0;
+		for (uint32 i = 0; i < b.size(); i++)
+			for (uint32 j = i + 1; j < b.size(); j++)
+				result += distance(b.positions[i], b.positions[j]) < b.radii[i] + b.radii[j];
+		return result;
+	}
+
+	void benchmarkBroadphase(uint32 count)
+	{
+		const PhysicsBodies b = makeBoulders(count);
+		PhysicsGrid grid;
+		const BenchmarkResult r = benchmarkBatch(count, 100, [&]() {
+			grid.build(b);
+			return grid.pairsCount(b);
+		});
+		benchmarkReport(Stringizer() + "physics broadphase, " + count + " bodies", r);
+		const BenchmarkResult brute = benchmarkBatch(count, 3, [&]() { return bruteForcePairs(b); });
+		benchmarkReport(Stringizer() + "physics brute force pairs, " + count + " bodies", brute);
+		const uint32 pairs = numeric_cast<uint32>(r.checksum / 100);
+		if (pairs * 3 != brute.checksum)
+			CAGE_THROW_ERROR(Exception, "broadphase missed some pairs");
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics broadphase, " + count + " bodies: " + pairs + " pairs, " + (pairs * 2.0 / count) + " per body");
+	}
+
+	// short chains away from the terrain settle and fall asleep, then one of them is pushed
+	void benchmarkSleeping()
+	{
+		Holder<EntityManager> ents = makeScene(0.05, 0.1, 4, 30);
+		PhysicsSimulation sim(newCollisionStructure({}), 1);
+		sim.deltaTime = DeltaTime;
+		PhysicsScene scene;
+		const auto &update = [&]() {
+			scene.gather(+ents);
+			sim.load(std::move(scene));
+			sim.run();
+			sim.store(scene);
+			scene.scatter();
+			return 0;
+		};
+		const BenchmarkResult moving = benchmarkBatch(1, 10, update);
+		benchmarkReport(Stringizer() + "physics sleeping, moving, " + scene.bodies.dynamicCount + " active", moving);
+		uint32 updates = 10;
+		while (scene.bodies.dynamicCount > 0 && updates < 3000)
+		{
+			update();
+			updates++;
+		}
+		const BenchmarkResult resting = benchmarkBatch(1, 10, update);
+		benchmarkReport(Stringizer() + "physics sleeping, resting, " + scene.bodies.dynamicCount + " active, " + scene.bodies.sleepingCount + " sleeping, after " + updates + " updates", resting);
+		if (scene.bodies.dynamicCount > 0)
+			CAGE_THROW_ERROR(Exception, "physics bodies did not fall asleep");
+		ents->component<PhysicsComponent>()->entities()[0]->value<PhysicsComponent>().velocity = Vec3(1, 0, 0);
+		update();
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics sleeping, after push: " + scene.bodies.dynamicCount + " active, " + scene.bodies.sleepingCount + " sleeping");
+		if (scene.bodies.dynamicCount != 4)
+			CAGE_THROW_ERROR(Exception, "pushed chain did not wake up");
+	}
+
+	// terrain triangles of one tile size area, with spheres scattered in random order around the surface
+	void benchmarkTerrainQueries()
+	{
+		constexpr uint32 size = 60;
+		constexpr uint32 spheresCount = 4000;
+		Holder<Collider> collider = newCollider();
+		const auto &vertex = [](uint32 x, uint32 y) {
+			const Vec2 p = Vec2(x, y);
+			return Vec3(p, terrainOffset(p));
+		};
+		for (uint32 y = 0; y < size; y++)
+		{
+			for (uint32 x = 0; x < size; x++)
+			{
+				collider->addTriangle(Triangle(vertex(x, y), vertex(x + 1, y), vertex(x + 1, y + 1)));
+				collider->addTriangle(Triangle(vertex(x, y), vertex(x + 1, y + 1), vertex(x, y + 1)));
+			}
+		}
+		collider->rebuild();
+		Holder<CollisionStructure> structure = newCollisionStructure({});
+		structure->update(1, std::move(collider), Transform());
+		structure->rebuild();
+		RandomGenerator rg(BenchmarkSeed, spheresCount);
+		std::vector<Sphere> spheres;
+		for (uint32 i = 0; i < spheresCount; i++)
+		{
+			const Vec2 p = Vec2(rg.randomChance(), rg.randomChance()) * size;
+			spheres.push_back(Sphere(Vec3(p, terrainOffset(p) + rg.randomRange(Real(-1), Real(1))), rg.randomRange(Real(0.3), Real(3))));
+		}
+
+		Holder<CollisionQuery> query = newCollisionQuery(structure.share());
+		const BenchmarkResult single = benchmarkBatch(spheresCount, 3, [&]() {
+			uint32 cnt = 0;
+			for (const Sphere &s : spheres)
+			{
+				if (query->query(s))
+					cnt += numeric_cast<uint32>(query->collisionPairs().size());
+			}
+			return cnt;
+		});
+		benchmarkReport("physics terrain spheres, one by one", single);
+		const uint32 maxThreads = std::max(std::thread::hardware_concurrency(), 2u);
+		for (uint32 threads = 1; threads <= maxThreads; threads++)
+		{
+			TerrainQueries batch(structure.share(), threads);
+			const BenchmarkResult r = benchmarkBatch(spheresCount, 3, [&]() {
+				batch.spheres(spheres);
+				return batch.triangles.size();
+			});
+			benchmarkReport(Stringizer() + "physics terrain spheres, batched, " + threads + " threads", r);
+			if (r.checksum != single.checksum)
+				CAGE_THROW_ERROR(Exception, "batched terrain queries found different contacts");
+			CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics terrain spheres speedup with " + threads + " threads: " + (single.nsPerCall() / r.nsPerCall()));
+		}
+	}
+
+	// same layout as the terrain tiles
+	Holder<TerrainHeights> makeHeights(sint32 x, sint32 y)
+	{
+		constexpr uint32 resolution = 60;
+		constexpr Real tileLength = 30;
+		Holder<TerrainHeights> h = systemMemory().createHolder<TerrainHeights>();
+		h->spacing = tileLength / (resolution - 5);
+		h->origin = Vec2(x, y) * tileLength - 2 * h->spacing;
+		h->tileLength = tileLength;
+		h->tileX = x;
+		h->tileY = y;
+		h->resolution = resolution;
+		std::vector<Vec2> positions;
+		for (uint32 j = 0; j < resolution; j++)
+			for (uint32 i = 0; i < resolution; i++)
+				positions.push_back(h->origin + Vec2(i, j) * h->spacing);
+		h->heights.resize(positions.size());
+		terrainOffset(positions, h->heights);
+		h->buildPyramid();
+		return h;
+	}
+
+	void benchmarkHeightfield()
+	{
+		constexpr sint32 tiles = 8;
+		PhysicsHeightfield hf;
+		for (sint32 y = 0; y < tiles; y++)
+			for (sint32 x = 0; x < tiles; x++)
+				hf.add(y * tiles + x + 1, makeHeights(x, y));
+		std::vector<Vec2> samples;
+		{
+			RandomGenerator rg(BenchmarkSeed, 7);
+			for (uint32 i = 0; i < 10000; i++)
+				samples.push_back(Vec2(rg.randomChance(), rg.randomChance()) * (tiles * 30));
+		}
+		const BenchmarkResult grid = benchmarkSamples<Vec2>(samples, 10, [&](const Vec2 &p) {
+			Vec2 g;
+			return (hf.sample(p, g) + g[0] + g[1]).value;
+		});
+		benchmarkReport("physics heightfield grid", grid);
+		const BenchmarkResult analytic = benchmarkSamples<Vec2>(samples, 10, [&](const Vec2 &p) {
+			Vec2 g;
+			return (terrainOffset(p, g) + g[0] + g[1]).value;
+		});
+		benchmarkReport("physics heightfield analytic", analytic);
+		Real maxError = 0, sumError = 0;
+		for (const Vec2 &p : samples)
+		{
+			Vec2 g;
+			const Real e = abs(hf.sample(p, g) - terrainOffset(p));
+			maxError = max(maxError, e);
+			sumError += e;
+		}
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics heightfield height error: max: " + maxError + ", average: " + (sumError / samples.size()) + ", speedup: " + (analytic.nsPerCall() / grid.nsPerCall()));
+	}
+
+	// cursor-like rays looking down at the terrain from above, against the min-max pyramids and against the triangle colliders of the same grids
+	void benchmarkTerrainRays()
+	{
+		constexpr sint32 tiles = 4;
+		constexpr uint32 raysCount = 10000;
+		PhysicsHeightfield hf;
+		Holder<CollisionStructure> structure = newCollisionStructure({});
+		for (sint32 y = 0; y < tiles; y++)
+		{
+			for (sint32 x = 0; x < tiles; x++)
+			{
+				Holder<TerrainHeights> h = makeHeights(x, y);
+				Holder<Collider> collider = newCollider();
+				const uint32 r = h->resolution;
+				const auto &vertex = [&](uint32 i, uint32 j) {
+					return Vec3(h->origin + Vec2(i, j) * h->spacing, h->heights[j * r + i]);
+				};
+				for (uint32 j = 0; j + 1 < r; j++)
+				{
+					for (uint32 i = 0; i + 1 < r; i++)
+					{
+						collider->addTriangle(Triangle(vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1)));
+						collider->addTriangle(Triangle(vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1)));
+					}
+				}
+				collider->rebuild();
+				const uint32 name = y * tiles + x + 1;
+				structure->update(name, std::move(collider), Transform());
+				hf.add(name, std::move(h));
+			}
+		}
+		structure->rebuild();
+
+		std::vector<Line> rays;
+		{
+			RandomGenerator rg(BenchmarkSeed, raysCount);
+			for (uint32 i = 0; i < raysCount; i++)
+			{
+				const Vec2 target = Vec2(rg.randomChance(), rg.randomChance()) * (tiles * 30 - 20) + 10;
+				const Vec3 origin = Vec3(target + Vec2(rg.randomChance() - 0.5, rg.randomChance() - 0.5) * 40, 100);
+				const Vec3 dir = normalize(Vec3(target, terrainOffset(target)) - origin);
+				rays.push_back(makeRay(origin, origin + dir));
+			}
+		}
+
+		std::vector<Vec3> pyramidHits(raysCount);
+		const BenchmarkResult pyramid = benchmarkBatch(raysCount, 10, [&]() {
+			double sum = 0;
+			for (uint32 i = 0; i < raysCount; i++)
+			{
+				pyramidHits[i] = hf.intersection(rays[i]);
+				sum += (pyramidHits[i][0] + pyramidHits[i][1] * 3 + pyramidHits[i][2] * 7).value;
+			}
+			return sum;
+		});
+		benchmarkReport("physics terrain rays, min-max pyramid", pyramid);
+		TerrainQueries queries(structure.share(), 1);
+		const BenchmarkResult bvh = benchmarkBatch(raysCount, 10, [&]() {
+			queries.rays(rays);
+			double sum = 0;
+			for (const Vec3 &p : queries.intersections)
+			{
+				if (p.valid())
+					sum += (p[0] + p[1] * 3 + p[2] * 7).value;
+			}
+			return sum;
+		});
+		benchmarkReport("physics terrain rays, colliders", bvh);
+		Real maxDifference = 0;
+		uint32 misses = 0;
+		for (uint32 i = 0; i < raysCount; i++)
+		{
+			if (queries.intersections[i].valid())
+				maxDifference = max(maxDifference, distance(queries.intersections[i], pyramidHits[i]));
+			else
+				misses++;
+		}
+		// the triangles split the cells along a diagonal, while the pyramid intersects the bilinear cells
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics terrain rays, max difference: " + maxDifference + ", colliders missed: " + misses + ", speedup: " + (bvh.nsPerCall() / pyramid.nsPerCall()));
+	}
+
+	// chains of 100 links hanging from static anchors, every other link collides
+	PhysicsScene makeChainsScenario(uint32 count)
+	{
+		constexpr uint32 length = 100;
+		const uint32 chains = max(count / length, 1u);
+		PhysicsScene scene;
+		PhysicsBodies &b = scene.bodies;
+		for (uint32 c = 0; c < chains; c++)
+		{
+			const Real x = 10 + (ScenarioSize - 20) * (c + 0.5) / chains;
+			for (uint32 i = 0; i < length; i++)
+			{
+				const Vec2 p = Vec2(x, ScenarioSize - 10 - i);
+				b.add(nullptr, Vec3(p, terrainOffset(p) + 3), Vec3(), 1 / sphereVolume(0.3), i % 2 ? Real(0.3) : Real::Nan());
+			}
+		}
+		b.dynamicCount = b.size();
+		for (uint32 c = 0; c < chains; c++)
+		{
+			const Vec2 p = Vec2(b.positions[c * length]) + Vec2(0, 1);
+			const uint32 anchor = b.add(nullptr, Vec3(p, terrainOffset(p) + 3), Vec3(), 0, Real::Nan());
+			for (uint32 i = 0; i < length; i++)
+			{
+				PhysicsSpring s;
+				s.bodies[0] = i ? c * length + i - 1 : anchor;
+				s.bodies[1] = c * length + i;
+				s.restDistance = 1;
+				s.stiffness = 0.05;
+				s.damping = 0.1;
+				scene.springs.push_back(s);
+				scene.springEntities.push_back(nullptr);
+			}
+		}
+		return scene;
+	}
+
+	// boulders with the radii from boulders.cpp, the layer above the terrain thickens with the count
+	PhysicsScene makeAvalancheScenario(uint32 count)
+	{
+		RandomGenerator rg(BenchmarkSeed, count);
+		const Real depth = count * 60 / sqr(ScenarioSize - 20);
+		PhysicsScene scene;
+		PhysicsBodies &b = scene.bodies;
+		for (uint32 i = 0; i < count; i++)
+		{
+			const Vec2 p = Vec2(rg.randomChance(), rg.randomChance()) * (ScenarioSize - 20) + 10;
+			const Real r = rg.randomChance() + 1.5;
+			b.add(nullptr, Vec3(p, terrainOffset(p) + r + rg.randomChance() * depth), Vec3(), 1 / (sphereVolume(r) * 0.5), r);
+		}
+		b.dynamicCount = b.size();
+		return scene;
+	}
+
+	// particles as emitted by the spring visuals, which do not collide
+	PhysicsScene makeParticlesScenario(uint32 count)
+	{
+		RandomGenerator rg(BenchmarkSeed, count);
+		PhysicsScene scene;
+		PhysicsBodies &b = scene.bodies;
+		for (uint32 i = 0; i < count; i++)
+		{
+			const Vec2 p = Vec2(rg.randomChance(), rg.randomChance()) * ScenarioSize;
+			b.add(nullptr, Vec3(p, terrainOffset(p) + 5), rg.randomDirection3() * 5, 1 / 0.05, Real::Nan());
+		}
+		b.dynamicCount = b.size();
+		return scene;
+	}
+
+	// boulders thrown fast along the heightfield, and hands thrown into the wall and pulled by clinch springs as in character.cpp
+	// the corrections count bodies that got behind the terrain
+	void benchmarkContinuousCollisions(const PhysicsHeightfield &heightfield)
+	{
+		constexpr uint32 count = 2000;
+		constexpr uint32 hands = 200;
+		constexpr uint32 updates = 60;
+		constexpr Real handRadius = 1.1;
+		struct Config
+		{
+			uint32 steps = 0;
+			bool ccd = false;
+		};
+		for (const Config cfg : { Config{ RepeatSteps, false }, Config{ RepeatSteps, true }, Config{ 1, true } })
+		{
+			PhysicsScene scene;
+			{
+				RandomGenerator rg(BenchmarkSeed, 13);
+				PhysicsBodies &b = scene.bodies;
+				for (uint32 i = 0; i < count; i++)
+				{
+					const Vec2 p = Vec2(rg.randomChance(), rg.randomChance() * 0.5 + 0.5) * (ScenarioSize - 20) + 10;
+					const Real r = rg.randomChance() * 0.5 + 0.5;
+					const Vec3 v = Vec3(rg.randomChance() - 0.5, -1, 0) * 150;
+					b.add(nullptr, Vec3(p, terrainOffset(p) + r), v, 1 / sphereVolume(r), r);
+				}
+				for (uint32 i = 0; i < hands; i++)
+				{
+					const Vec2 p = Vec2(rg.randomChance(), rg.randomChance()) * (ScenarioSize - 40) + 20;
+					b.add(nullptr, Vec3(p, terrainOffset(p) + 10), Vec3(0, 0, -100), 1 / sphereVolume(handRadius), handRadius);
+				}
+				b.dynamicCount = b.size();
+				for (uint32 i = 0; i < hands; i++)
+				{
+					const uint32 hand = count + i;
+					const Vec2 p = Vec2(b.positions[hand]) + Vec2(rg.randomChance() - 0.5, rg.randomChance() - 0.5) * 20;
+					PhysicsSpring s;
+					s.bodies[0] = b.add(nullptr, Vec3(p, terrainOffset(p) + ClinchTerrainOffset), Vec3(), 0, Real::Nan());
+					s.bodies[1] = hand;
+					s.restDistance = 0;
+					s.stiffness = 0.3;
+					s.damping = 0.3;
+					scene.springs.push_back(s);
+					scene.springEntities.push_back(nullptr);
+				}
+			}
+			PhysicsSimulation sim(newCollisionStructure({}), 1);
+			sim.repeatSteps = cfg.steps;
+			sim.deltaTime = DeltaTime * RepeatSteps / sim.repeatSteps;
+			sim.heightfield = &heightfield;
+			sim.continuousCollisions = cfg.ccd;
+			uint32 corrections = 0;
+			BenchmarkResult r = benchmarkBatch(count + hands, updates, [&]() {
+				sim.load(std::move(scene));
+				sim.run();
+				sim.store(scene);
+				corrections += sim.statistics.wallCorrections;
+				return 0;
+			});
+			for (const Vec3 &p : scene.bodies.positions)
+				r.checksum += (p[0] + p[1] * 3 + p[2] * 7).value;
+			const String name = Stringizer() + cfg.steps + (cfg.steps == 1 ? " step" : " steps") + (cfg.ccd ? ", continuous collisions" : "");
+			benchmarkReport(Stringizer() + "physics fast bodies, " + name + ", per body", r);
+			CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics fast bodies, " + name + ", wall corrections: " + corrections);
+			if (cfg.ccd && corrections != 0)
+				CAGE_THROW_ERROR(Exception, "fast bodies tunnelled through the terrain despite the continuous collisions");
+		}
+	}
+
+	// time of one update for growing scenes, the exponent of the growth of the time reveals superlinear parts of the simulation
+	void benchmarkScenario(const String &name, PhysicsScene (*make)(uint32), const PhysicsHeightfield &heightfield)
+	{
+		double previousTime = 0;
+		uint32 previousCount = 0;
+		for (uint32 count : { 1000, 4000, 16000 })
+		{
+			PhysicsScene scene = make(count);
+			const uint32 springs = numeric_cast<uint32>(scene.springs.size());
+			PhysicsSimulation sim(newCollisionStructure({}), 1);
+			sim.deltaTime = DeltaTime;
+			sim.heightfield = &heightfield;
+			const auto &update = [&]() {
+				sim.load(std::move(scene));
+				sim.run();
+				sim.store(scene);
+				return 0;
+			};
+			for (uint32 i = 0; i < 3; i++)
+				update();
+			BenchmarkResult r = benchmarkBatch(count, ScenarioUpdates, update);
+			for (const Vec3 &p : scene.bodies.positions)
+				r.checksum += (p[0] + p[1] * 3 + p[2] * 7).value;
+			benchmarkReport(Stringizer() + "physics scenario " + name + ", " + count + " bodies, " + springs + " springs, per body", r);
+			const double updateTime = (double)r.nanoseconds / ScenarioUpdates;
+			if (previousCount)
+			{
+				const double exponent = std::log(updateTime / previousTime) / std::log((double)count / previousCount);
+				CAGE_LOG(exponent > 1.2 ? SeverityEnum::Warning : SeverityEnum::Info, "benchmark", Stringizer() + "physics scenario " + name + ", " + count + " bodies: " + (updateTime * 1e-6) + " ms per update, scaling exponent: " + exponent);
+			}
+			{ // split of the last update among the phases
+				Stringizer phases;
+				phases + "physics scenario " + name + ", " + count + " bodies, contact pairs: " + sim.statistics.contactPairs + ", terrain contacts: " + sim.statistics.terrainContacts + ", phases (us):";
+				for (uint32 i = 0; i < (uint32)PhysicsPhaseEnum::Count; i++)
+				{
+					if (sim.statistics.phaseTimes[i])
+						phases + " " + PhysicsPhaseNames[i] + ": " + (sim.statistics.phaseTimes[i] / 1000);
+				}
+				CAGE_LOG(SeverityEnum::Info, "benchmark", phases);
+			}
+			previousTime = updateTime;
+			previousCount = count;
+		}
+	}
+
+	void benchmarkScenarios()
+	{
+		PhysicsHeightfield hf;
+		for (sint32 y = 0; y < ScenarioTiles; y++)
+			for (sint32 x = 0; x < ScenarioTiles; x++)
+				hf.add(y * ScenarioTiles + x + 1, makeHeights(x, y));
+		benchmarkScenario("chains", &makeChainsScenario, hf);
+		benchmarkScenario("avalanche", &makeAvalancheScenario, hf);
+		benchmarkScenario("particles", &makeParticlesScenario, hf);
+		benchmarkContinuousCollisions(hf);
+	}
+
+	// kinetic, gravitational and elastic energy of the loaded bodies, the simulation is empty after store
+	double energy(const PhysicsSimulation &sim)
+	{
+		const PhysicsBodies &b = sim.bodies;
+		double r = 0;
+		for (uint32 i = 0; i < b.dynamicCount + b.sleepingCount; i++)
+		{
+			const Real m = 1 / b.invMasses[i];
+			r += (m * lengthSquared(b.velocities[i]) * 0.5 + m * 9.8 * b.positions[i][1]).value;
+		}
+		for (const PhysicsSpring &s : sim.springs)
+		{
+			const Real m = 1 / (b.invMasses[s.bodies[0]] + b.invMasses[s.bodies[1]]);
+			const Real k = s.stiffness * m / (sim.referenceStep * sim.referenceStep);
+			const Real x = distance(b.positions[s.bodies[0]], b.positions[s.bodies[1]]) - s.restDistance;
+			r += (k * x * x * 0.5).value;
+		}
+		return r;
+	}
+
+	// energy should only decrease, any gain is a sign of instability or of unconverged constraints
+	void benchmarkSolver(const String &name, PhysicsSolverEnum solver, Real stiffness, Real damping, uint32 repeatSteps = RepeatSteps)
+	{
+		Holder<EntityManager> ents = makeScene(stiffness, damping);
+		PhysicsSimulation sim(newCollisionStructure({}), 1);
+		sim.repeatSteps = repeatSteps;
+		sim.deltaTime = DeltaTime * RepeatSteps / repeatSteps;
+		sim.solver = solver;
+		sim.load(+ents);
+		const double start = energy(sim);
+		double current = start;
+		double gain = 0;
+		uint32 updates = 0;
+		BenchmarkResult r;
+		{
+			const auto begin = std::chrono::steady_clock::now();
+			while (updates < DriftUpdatesCount)
+			{
+				sim.load(+ents);
+				sim.run();
+				current = energy(sim);
+				sim.store();
+				updates++;
+				gain = std::max(gain, current - start);
+				if (!(gain < std::abs(start) * 100))
+					break; // diverged
+			}
+			const auto end = std::chrono::steady_clock::now();
+			r.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+			r.calls = updates;
+			r.checksum = checksum(+ents);
+		}
+		benchmarkReport(Stringizer() + "physics solver " + name, r);
+		if (updates < DriftUpdatesCount)
+			CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics solver " + name + " diverged after " + updates + " updates");
+		else
+			CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics solver " + name + " energy: start: " + start + ", max gain: " + gain + ", final change: " + (current - start));
+		// every chain link has two springs, their jacobi corrections must not feed energy into the chains
+		if (solver == PhysicsSolverEnum::Xpbd && !(updates == DriftUpdatesCount && gain <= std::abs(start) * 0.01))
+			CAGE_THROW_ERROR(Exception, "xpbd solver gains energy on chains");
+	}
+}
+
+void benchmarkPhysics()
+{
+	const uint32 maxThreads = std::max(std::thread::hardware_concurrency(), 2u);
+	for (PhysicsSolverEnum solver : { PhysicsSolverEnum::Explicit, PhysicsSolverEnum::Xpbd })
+	{
+		const String name = solver == PhysicsSolverEnum::Xpbd ? "xpbd" : "explicit";
+		BenchmarkResult single;
+		for (uint32 threads = 1; threads <= maxThreads; threads++)
+		{
+			Holder<EntityManager> ents = makeScene();
+			PhysicsSimulation sim(newCollisionStructure({}), threads);
+			sim.deltaTime = DeltaTime;
+			sim.solver = solver;
+			BenchmarkResult r = benchmarkBatch(ChainsCount * ChainLength, UpdatesCount, [&]() {
+				sim.load(+ents);
+				sim.run();
+				sim.store();
+				return 0;
+			});
+			r.checksum = checksum(+ents);
+			benchmarkReport(Stringizer() + "physics " + name + " update, " + threads + " threads", r);
+			if (threads == 1)
+				single = r;
+			else
+			{
+				if (r.checksum != single.checksum)
+					CAGE_THROW_ERROR(Exception, "physics simulation depends on the number of threads");
+				CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "physics " + name + " speedup with " + threads + " threads: " + (single.nsPerCall() / r.nsPerCall()));
+			}
+		}
+	}
+
+	benchmarkSolver("explicit", PhysicsSolverEnum::Explicit, 0.3, 0.05);
+	benchmarkSolver("xpbd", PhysicsSolverEnum::Xpbd, 0.3, 0.05);
+	benchmarkSolver("explicit stiff", PhysicsSolverEnum::Explicit, 0.9, 0.01);
+	benchmarkSolver("xpbd stiff", PhysicsSolverEnum::Xpbd, 0.9, 0.01);
+	// the game defaults to a single step per update
+	benchmarkSolver("explicit 1 step", PhysicsSolverEnum::Explicit, 0.3, 0.05, 1);
+	benchmarkSolver("explicit stiff 1 step", PhysicsSolverEnum::Explicit, 0.9, 0.01, 1);
+
+	for (uint32 count : { 100, 400, 1600, 6400 })
+		benchmarkBroadphase(count);
+	benchmarkTerrainQueries();
+	benchmarkSleeping();
+	benchmarkHeightfield();
+	benchmarkTerrainRays();
+	benchmarkScenarios();
+}
@@ -0,0 +1,117 @@
+#include "benchmark.h"
+
+#include <cage-core/random.h>
+
+#include <vector>
+
+namespace
+{
+	struct SampleSet
+	{
+		String name;
+		std::vector<Vec2> positions;
+	};
+
+	constexpr uint32 SamplesCount = 128 * 128;
+
+	std::vector<SampleSet> sampleSets()
+	{
+		std::vector<SampleSet> sets;
+		RandomGenerator rg(BenchmarkSeed, 13);
+
+		{ // uniformly scattered over a large area, no coherence between consecutive samples
+			SampleSet s;
+			s.name = "random";
+			for (uint32 i = 0; i < SamplesCount; i++)
+				s.positions.push_back((Vec2(rg.randomChance(), rg.randomChance()) - 0.5) * 10000);
+			sets.push_back(std::move(s));
+		}
+
+		{ // texels of a terrain tile
+			SampleSet s;
+			s.name = "grid";
+			for (uint32 y = 0; y < 128; y++)
+				for (uint32 x = 0; x < 128; x++)
+					s.positions.push_back(Vec2(x, y) * 0.33);
+			sets.push_back(std::move(s));
+		}
+
+		{ // far from the origin, where floats lose precision
+			SampleSet s;
+			s.name = "far";
+			for (uint32 i = 0; i < SamplesCount; i++)
+				s.positions.push_back(Vec2(1e6, -1e6) + (Vec2(rg.randomChance(), rg.randomChance()) - 0.5) * 100);
+			sets.push_back(std::move(s));
+		}
+
+		return sets;
+	}
+
+	double materialChecksum(const std::vector<Vec3> &colors, const std::vector<Real> &roughness, const std::vector<Real> &metallic)
+	{
+		double r = 0;
+		for (uint32 i = 0; i < colors.size(); i++)
+			r += (colors[i][0] + colors[i][1] + colors[i][2] + roughness[i] + metallic[i]).value;
+		return r;
+	}
+
+	void benchmarkSet(const TerrainGenerator *generator, const SampleSet &set)
+	{
+		const PointerRange<const Vec2> positions = set.positions;
+		const uint32 cnt = numeric_cast<uint32>(positions.size());
+		std::vector<Real> heights(cnt);
+		std::vector<Vec2> gradients(cnt);
+		std::vector<Vec3> colors(cnt);
+		std::vector<Real> roughness(cnt), metallic(cnt);
+
+		benchmarkReport(set.name + " offset single", benchmarkSamples(positions, 1, [&](const Vec2 &p) { return generator->offset(p).value; }));
+
+		benchmarkReport(set.name + " offset batched", benchmarkBatch(cnt, 1, [&]() {
+			generator->offset(positions, heights);
+			double r = 0;
+			for (Real h : heights)
+				r += h.value;
+			return r;
+		}));
+
+		benchmarkReport(set.name + " offset gradient", benchmarkBatch(cnt, 1, [&]() {
+			generator->offset(positions, heights, gradients);
+			double r = 0;
+			for (uint32 i = 0; i < cnt; i++)
+				r += (heights[i] + gradients[i][0] + gradients[i][1]).value;
+			return r;
+		}));
+
+		benchmarkReport(set.name + " material", benchmarkBatch(cnt, 1, [&]() {
+			generator->material(positions, colors, roughness, metallic, false, 0);
+			return materialChecksum(colors, roughness, metallic);
+		}));
+
+		benchmarkReport(set.name + " material coarse", benchmarkBatch(cnt, 1, [&]() {
+			generator->material(positions, colors, roughness, metallic, false, 0.01);
+			return materialChecksum(colors, roughness, metallic);
+		}));
+
+		benchmarkReport(set.name + " material rock only", benchmarkBatch(cnt, 1, [&]() {
+			generator->material(positions, colors, roughness, metallic, true, 0);
+			return materialChecksum(colors, roughness, metallic);
+		}));
+
+		// layers include the evaluation of the height
+		static constexpr const char *LayerNames[] = { "basesWeights", "basePaper", "baseSphinx", "baseWhite", "baseDarkRock1", "baseDarkRock2" };
+		for (uint32 l = 0; l < sizeof(LayerNames) / sizeof(LayerNames[0]); l++)
+		{
+			benchmarkReport(set.name + " layer " + LayerNames[l], benchmarkBatch(cnt, 1, [&]() {
+				generator->layer((TerrainLayerEnum)l, positions, colors, roughness, metallic);
+				return materialChecksum(colors, roughness, metallic);
+			}));
+		}
+	}
+}
+
+void benchmarkProcedural()
+{
+	Holder<TerrainGenerator> generator = newTerrainGenerator(BenchmarkSeed);
+	for (const SampleSet &set : sampleSets())
+		benchmarkSet(+generator, set);
+}
@@ -0,0 +1,87 @@
+#include "benchmark.h"
+
+#include <thread>
+#include <vector>
+
+namespace
+{
+	constexpr uint32 GeneratorsCount = 8;
+
+	// heights and materials of a small patch of terrain, returns checksum of the results
+	double generatePatch(const TerrainGenerator *generator)
+	{
+		std::vector<Vec2> positions;
+		positions.reserve(64 * 64);
+		for (uint32 y = 0; y < 64; y++)
+			for (uint32 x = 0; x < 64; x++)
+				positions.push_back(Vec2(x, y) * 0.33);
+		const uint32 cnt = numeric_cast<uint32>(positions.size());
+		std::vector<Real> heights(cnt);
+		std::vector<Vec3> colors(cnt);
+		std::vector<Real> roughness(cnt), metallic(cnt);
+		generator->offset(positions, heights);
+		generator->material(positions, colors, roughness, metallic, false, 0);
+		double checksum = 0;
+		for (uint32 i = 0; i < cnt; i++)
+			checksum += (heights[i] + colors[i][0] + colors[i][1] + colors[i][2] + roughness[i] + metallic[i]).value;
+		return checksum;
+	}
+}
+
+void benchmarkTerrainGenerator()
+{
+	std::vector<Holder<TerrainGenerator>> generators;
+	BenchmarkResult creation;
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (uint32 i = 0; i < GeneratorsCount; i++)
+			generators.push_back(newTerrainGenerator(i + 13));
+		const auto end = std::chrono::steady_clock::now();
+		creation.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		creation.calls = GeneratorsCount;
+	}
+	benchmarkReport("terrainGenerator creation", creation);
+
+	double sequential[GeneratorsCount] = {};
+	BenchmarkResult a;
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (uint32 i = 0; i < GeneratorsCount; i++)
+			sequential[i] = generatePatch(+generators[i]);
+		const auto end = std::chrono::steady_clock::now();
+		a.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		a.calls = GeneratorsCount;
+		for (double c : sequential)
+			a.checksum += c;
+	}
+	benchmarkReport("terrainGenerator patch sequential", a);
+
+	double concurrent[GeneratorsCount] = {};
+	BenchmarkResult b;
+	{
+		const auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads;
+		for (uint32 i = 0; i < GeneratorsCount; i++)
+			threads.emplace_back([&, i]() { concurrent[i] = generatePatch(+generators[i]); });
+		for (std::thread &t : threads)
+			t.join();
+		const auto end = std::chrono::steady_clock::now();
+		b.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		b.calls = GeneratorsCount;
+		for (double c : concurrent)
+			b.checksum += c;
+	}
+	benchmarkReport("terrainGenerator patch concurrent", b);
+
+	for (uint32 i = 0; i < GeneratorsCount; i++)
+	{
+		if (sequential[i] != concurrent[i])
+			CAGE_THROW_ERROR(Exception, "concurrent terrain generation differs from sequential");
+	}
+	{
+		Holder<TerrainGenerator> again = newTerrainGenerator(13);
+		if (generatePatch(+again) != sequential[0])
+			CAGE_THROW_ERROR(Exception, "terrain generation is not reproducible from the seed");
+	}
+	CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "terrainGenerator concurrent speedup: " + (a.nsPerCall() / b.nsPerCall()));
+}
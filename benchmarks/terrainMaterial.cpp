@@ -0,0 +1,73 @@
+#include "benchmark.h"
+
+#include <vector>
+
+void benchmarkTerrainMaterial()
+{
+	Holder<TerrainGenerator> generator = newTerrainGenerator(BenchmarkSeed);
+	std::vector<Vec2> positions;
+	positions.reserve(256 * 256);
+	for (uint32 y = 0; y < 256; y++)
+		for (uint32 x = 0; x < 256; x++)
+			positions.push_back(Vec2(x, y) * 0.33); // texel spacing of the terrain tiles
+	const uint32 cnt = numeric_cast<uint32>(positions.size());
+	std::vector<Vec3> colors(cnt);
+	std::vector<Real> roughness(cnt), metallic(cnt);
+
+	const PointerRange<const Vec2> range = positions;
+	const BenchmarkResult a = benchmarkSamples(range, 1, [&](const Vec2 &p) {
+		Vec3 c;
+		Real r, m;
+		generator->material(p, c, r, m, false);
+		return (c[0] + c[1] + c[2] + r + m).value;
+	});
+	benchmarkReport("terrainMaterial single", a);
+
+	const auto &batched = [&](Real tolerance, std::vector<Vec3> &colors, std::vector<Real> &roughness, std::vector<Real> &metallic) {
+		BenchmarkResult r;
+		const auto start = std::chrono::steady_clock::now();
+		generator->material(positions, colors, roughness, metallic, false, tolerance);
+		const auto end = std::chrono::steady_clock::now();
+		r.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		r.calls = cnt;
+		for (uint32 i = 0; i < cnt; i++)
+			r.checksum += (colors[i][0] + colors[i][1] + colors[i][2] + roughness[i] + metallic[i]).value;
+		return r;
+	};
+
+	const BenchmarkResult b = batched(0, colors, roughness, metallic);
+	benchmarkReport("terrainMaterial batched", b);
+	CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "terrainMaterial speedup: " + (a.nsPerCall() / b.nsPerCall()));
+
+	{ // coarse low frequency fields compared to the exact evaluation
+		std::vector<Vec3> colors2(cnt);
+		std::vector<Real> roughness2(cnt), metallic2(cnt);
+		const BenchmarkResult c = batched(0.01, colors2, roughness2, metallic2);
+		benchmarkReport("terrainMaterial coarse fields", c);
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "terrainMaterial coarse fields speedup: " + (b.nsPerCall() / c.nsPerCall()));
+		Real maxDiff, sumDiff;
+		uint32 differing = 0;
+		for (uint32 i = 0; i < cnt; i++)
+		{
+			Real d = max(abs(roughness[i] - roughness2[i]), abs(metallic[i] - metallic2[i]));
+			for (uint32 j = 0; j < 3; j++)
+				d = max(d, abs(colors[i][j] - colors2[i][j]));
+			maxDiff = max(maxDiff, d);
+			sumDiff += d;
+			if (d > 0.02)
+				differing++;
+		}
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "terrainMaterial coarse fields error: mean: " + (sumDiff / cnt) + ", max: " + maxDiff + ", texels above 0.02: " + (100.0 * differing / cnt) + " %");
+	}
+
+	for (Real tolerance : { 0.003, 0.01, 0.03 })
+	{
+		uint32 fields = 0;
+		const Real error = generator->coarseFieldsError(positions, tolerance, fields);
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "terrainMaterial coarse fields, tolerance: " + tolerance + ", fields: " + fields + ", max field error: " + error);
+		if (fields == 0)
+			CAGE_THROW_ERROR(Exception, "no coarse field was built");
+		if (error > tolerance)
+			CAGE_THROW_ERROR(Exception, "coarse field error exceeds the tolerance");
+	}
+}
@@ -0,0 +1,169 @@
+#include "benchmark.h"
+
+#include <cage-core/noiseFunction.h>
+#include <cage-core/random.h>
+
+#include <vector>
+
+namespace
+{
+	// the height function as it was composed before the fused kernel
+	// each layer is a separate NoiseFunction object evaluated through the library
+	// the seeds are drawn the same way as in the generator, starting at the base of its offset noises
+	class LegacyTerrainOffset
+	{
+		const uint32 base = 0;
+		uint32 index = 35741890;
+
+		uint32 nextSeed()
+		{
+			index = hash(index);
+			return base + index;
+		}
+
+		Holder<NoiseFunction> newClouds(uint32 octaves)
+		{
+			NoiseFunctionCreateConfig cfg;
+			cfg.seed = nextSeed();
+			cfg.octaves = octaves;
+			cfg.type = NoiseTypeEnum::Value;
+			return newNoiseFunction(cfg);
+		}
+
+		Holder<NoiseFunction> newCell(NoiseOperationEnum operation = NoiseOperationEnum::Distance)
+		{
+			NoiseFunctionCreateConfig cfg;
+			cfg.seed = nextSeed();
+			cfg.type = NoiseTypeEnum::Cellular;
+			cfg.operation = operation;
+			cfg.distance = NoiseDistanceEnum::Euclidean;
+			return newNoiseFunction(cfg);
+		}
+
+		Holder<NoiseFunction> clouds1 = newClouds(3);
+		Holder<NoiseFunction> clouds2 = newClouds(3);
+		Holder<NoiseFunction> clouds3 = newClouds(3);
+		Holder<NoiseFunction> clouds4 = newClouds(3);
+		Holder<NoiseFunction> clouds5 = newClouds(3);
+		Holder<NoiseFunction> clouds6 = newClouds(3);
+		Holder<NoiseFunction> clouds7 = newClouds(3);
+		Holder<NoiseFunction> clouds8 = newClouds(3);
+		Holder<NoiseFunction> clouds9 = newClouds(3);
+		Holder<NoiseFunction> clouds10 = newClouds(3);
+		Holder<NoiseFunction> cell1 = newCell();
+		Holder<NoiseFunction> cell2 = newCell(NoiseOperationEnum::Subtract);
+
+		static Real evaluateClamp(Holder<NoiseFunction> &noiseFunction, const Vec2 &position)
+		{
+			return noiseFunction->evaluate(position) * 0.5 + 0.5;
+		}
+
+		static Real rerange(Real v, Real ia, Real ib, Real oa, Real ob)
+		{
+			return (v - ia) / (ib - ia) * (ob - oa) + oa;
+		}
+
+		static Real sharpEdge(Real v)
+		{
+			return rerange(clamp(v, 0.45, 0.55), 0.45, 0.55, 0, 1);
+		}
+
+		static Real slab(Real v)
+		{
+			v = v % 1;
+			if (v > 0.8)
+				return sin(Rads::Full() * 0.5 * (v - 0.8) / 0.2 + Rads::Full() * 0.25);
+			return v / 0.8;
+		}
+
+	public:
+		explicit LegacyTerrainOffset(uint32 generatorSeed) : base(generatorSeed + hash(35741890))
+		{}
+
+		Real operator () (const Vec2 &pos)
+		{
+			Real result;
+			result -= pos[1] * 0.2;
+			{
+				Real off = evaluateClamp(clouds1, pos * 0.0065);
+				Real mask = evaluateClamp(clouds2, pos * 0.00715);
+				result += slab(pos[1] * 0.027 + off * 2.5) * sharpEdge(mask * 2 - 0.7) * 5;
+			}
+			{
+				Real a = evaluateClamp(cell1, pos * 0.0241);
+				Real b = clouds3->evaluate(pos * 0.041);
+				result += sharpEdge(a + b - 0.4);
+			}
+			{
+				Real scl = evaluateClamp(clouds4, pos * 0.00921);
+				Real rot = evaluateClamp(clouds5, pos * 0.00398);
+				Vec2 off = Vec2(rot + 0.5, 1.5 - rot);
+				Real mask = evaluateClamp(clouds6, pos * 0.00654);
+				Real a = evaluateClamp(cell2, (pos * 0.01 + off) * (scl + 0.5));
+				result += pow((min(a + 0.95, 1) - 0.95) * 20, 3) * sharpEdge(mask - 0.1) * 0.5;
+			}
+			{
+				Real a = pow(evaluateClamp(clouds7, pos * Vec2(0.036, 0.13)), 0.2);
+				Real b = pow(evaluateClamp(clouds8, pos * Vec2(0.047, 0.029)), 0.1);
+				result += min(a, b) * 3;
+			}
+			{
+				Real a = pow(evaluateClamp(clouds9, pos * Vec2(0.11, 0.027) * 0.5), 0.2);
+				Real b = pow(evaluateClamp(clouds10, pos * Vec2(0.033, 0.051) * 0.5), 0.1);
+				result += min(a, b) * 3;
+			}
+			return result;
+		}
+	};
+
+	std::vector<Vec2> randomSamples(uint32 count)
+	{
+		RandomGenerator rg(123, 456);
+		std::vector<Vec2> v;
+		v.reserve(count);
+		for (uint32 i = 0; i < count; i++)
+			v.push_back((Vec2(rg.randomChance(), rg.randomChance()) - 0.5) * 10000);
+		return v;
+	}
+}
+
+void benchmarkTerrainOffset()
+{
+	const std::vector<Vec2> samples = randomSamples(100000);
+	const PointerRange<const Vec2> range = samples;
+
+	Holder<TerrainGenerator> generator = newTerrainGenerator(BenchmarkSeed);
+	LegacyTerrainOffset legacy(BenchmarkSeed);
+
+	{ // the fused kernel must be the same function as the legacy composition
+		Real maxDifference;
+		for (const Vec2 &p : samples)
+			maxDifference = max(maxDifference, abs(legacy(p) - generator->offset(p)));
+		CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "terrainOffset max difference: " + maxDifference);
+		if (maxDifference > 1e-3)
+			CAGE_THROW_ERROR(Exception, "fused terrainOffset differs from the legacy composition");
+	}
+
+	const BenchmarkResult a = benchmarkSamples(range, 5, [&](const Vec2 &p) { return legacy(p).value; });
+	benchmarkReport("terrainOffset legacy", a);
+
+	const BenchmarkResult b = benchmarkSamples(range, 5, [&](const Vec2 &p) { return generator->offset(p).value; });
+	benchmarkReport("terrainOffset fused", b);
+
+	CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "terrainOffset speedup: " + (a.nsPerCall() / b.nsPerCall()));
+
+	const BenchmarkResult c = benchmarkSamples(range, 5, [&](const Vec2 &p) {
+		const Real z = generator->offset(p);
+		return (z + (generator->offset(p + Vec2(0.5, 0)) - z) + (generator->offset(p + Vec2(0, 0.5)) - z)).value;
+	});
+	benchmarkReport("terrainOffset forward differences", c);
+
+	const BenchmarkResult d = benchmarkSamples(range, 5, [&](const Vec2 &p) {
+		Vec2 g;
+		const Real z = generator->offset(p, g);
+		return (z + g[0] * 0.5 + g[1] * 0.5).value;
+	});
+	benchmarkReport("terrainOffset analytic gradient", d);
+
+	CAGE_LOG(SeverityEnum::Info, "benchmark", Stringizer() + "terrainOffset gradient speedup: " + (c.nsPerCall() / d.nsPerCall()));
+}
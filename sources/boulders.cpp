@@ -1,7 +1,9 @@
 #include "common.h"
+#include "physics.h"
 
 #include <cage-core/entities.h>
 #include <cage-core/hashString.h>
+#include <cage-core/config.h>
 
 #include <cage-engine/scene.h>
 #include <cage-simple/engine.h>
@@ -10,13 +12,59 @@
 
 namespace
 {
+	// boulders farther from the player roll analytically along the terrain, without collisions, and rejoin the physics on approach
+	// the camera looks at the player from a fixed height, therefore the distance decides the visibility too
+	ConfigFloat bouldersLodDistance("cragsman/boulders/lodDistance", 100);
+
 	struct BoulderComponent
-	{};
+	{
+		Vec3 velocity; // of the simplified simulation
+		bool simplified = false;
+	};
+
+	void addPhysics(Entity *e, const Vec3 &velocity)
+	{
+		const TransformComponent &t = e->value<TransformComponent>();
+		PhysicsComponent &p = e->value<PhysicsComponent>();
+		p.collisionRadius = t.scale;
+		p.mass = sphereVolume(p.collisionRadius) * 0.5;
+		p.velocity = velocity;
+	}
+
+	// gravity projected onto the tangent plane of the terrain, with the same damping as the physics
+	void simplifiedSimulation(PointerRange<Entity *const> ents)
+	{
+		if (ents.empty())
+			return;
+		std::vector<Vec2> positions;
+		positions.reserve(ents.size());
+		for (Entity *e : ents)
+			positions.push_back(Vec2(e->value<TransformComponent>().position));
+		std::vector<Real> offsets(ents.size());
+		std::vector<Vec2> gradients(ents.size());
+		terrainOffset(positions, offsets, gradients);
+		const Real dt = gameUpdatePeriod() * 1e-6;
+		const Real damping = physicsDamping(dt);
+		const Vec3 g = Vec3(0, -9.8, 0);
+		for (uint32 i = 0; i < ents.size(); i++)
+		{
+			TransformComponent &t = ents[i]->value<TransformComponent>();
+			Vec3 &v = ents[i]->value<BoulderComponent>().velocity;
+			const Vec3 n = normalize(Vec3(-gradients[i], 1));
+			v = v * damping + (g - n * dot(g, n)) * dt;
+			v -= n * dot(v, n);
+			t.position += v * dt;
+			t.position[2] = offsets[i] + t.scale; // follows the terrain at the position from the beginning of the update
+		}
+	}
 
 	const auto engineUpdateListener = controlThread().update.listen([]() {
+		if (replayHolding())
+			return;
 		if (!characterBody)
 			return;
 		TransformComponent &pt = engineEntities()->get(characterBody)->value<TransformComponent>();
+		const Real lodDistance = (float)bouldersLodDistance;
 		if (randomChance() < 0.01)
 		{ // spawn a boulder
 			Entity *e = engineEntities()->createAnonymous();
@@ -31,25 +79,45 @@ namespace
 				Real dummy;
 				terrainMaterial(Vec2(t.position), r.color, dummy, dummy, true);
 			}
-			PhysicsComponent &p = e->value<PhysicsComponent>();
-			p.collisionRadius = t.scale;
-			p.mass = sphereVolume(p.collisionRadius) * 0.5;
-			e->value<BoulderComponent>();
+			BoulderComponent &b = e->value<BoulderComponent>();
+			b.simplified = distance(Vec2(t.position), Vec2(pt.position)) > lodDistance;
+			if (!b.simplified)
+				addPhysics(e, Vec3());
 		}
 		std::vector<Entity *> entsToDestroy;
+		std::vector<Entity *> simplified;
 		for (Entity *e : engineEntities()->component<BoulderComponent>()->entities())
-		{ // rotate boulders
+		{
 			TransformComponent &t = e->value<TransformComponent>();
 			if (t.position[1] < pt.position[1] - 150)
+			{
 				entsToDestroy.push_back(e);
+				continue;
+			}
+			BoulderComponent &b = e->value<BoulderComponent>();
+			const Real dist = distance(Vec2(t.position), Vec2(pt.position));
+			if (b.simplified && dist < lodDistance)
+			{ // promote to the physics
+				b.simplified = false;
+				addPhysics(e, b.velocity);
+			}
+			else if (!b.simplified && dist > lodDistance * 1.2)
+			{ // demote, the hysteresis prevents switching back and forth
+				b.simplified = true;
+				b.velocity = e->value<PhysicsComponent>().velocity;
+				e->remove<PhysicsComponent>();
+			}
+			if (b.simplified)
+				simplified.push_back(e);
 			else
-			{
+			{ // rotate boulders
 				PhysicsComponent &p = e->value<PhysicsComponent>();
 				Vec3 r = 1.5 * p.velocity / p.collisionRadius;
 				Quat rot = Quat(Degs(r[2] - r[1]), Degs(), Degs(-r[0]));
 				t.orientation = rot * t.orientation;
 			}
 		}
+		simplifiedSimulation(simplified);
 		for (auto e : entsToDestroy)
 			e->destroy();
 	});
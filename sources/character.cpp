@@ -30,22 +30,10 @@ namespace
 	uint32 characterShoulders[characterHandsCount];
 	uint32 characterHandJoints[characterHandsCount];
 	uint32 currentHand;
+	bool clinchRequested = false;
 
 	VariableSmoothingBuffer<Vec3> smoothBodyPosition;
 
-	Entity *addSpring(uint32 a, uint32 b, Real restDistance, Real stiffness, Real damping)
-	{
-		Entity *spring = engineEntities()->createUnique();
-		SpringComponent &s = spring->value<SpringComponent>();
-		s.objects[0] = a;
-		s.objects[1] = b;
-		s.restDistance = restDistance;
-		s.stiffness = stiffness;
-		s.damping = damping;
-		std::sort(s.objects, s.objects + 1);
-		return spring;
-	}
-
 	Vec3 colorIndex(uint32 i)
 	{
 		switch (i)
@@ -59,57 +47,42 @@ namespace
 
 	void jointHandClinch(uint32 handIndex, uint32 clinchName)
 	{
-		Entity *e = addSpring(characterHands[handIndex], clinchName, 0, 0.3, 0.3);
+		Entity *e = springCreate(characterHands[handIndex], clinchName, 0, 0.3, 0.3);
 		characterHandJoints[handIndex] = e->name();
 	}
 
-	void removeSprings(uint32 n)
-	{
-		auto sns = engineEntities()->component<SpringComponent>()->entities();
-		std::vector<Entity *> ses(sns.begin(), sns.end());
-		for (Entity *e : ses)
-		{
-			SpringComponent &s = e->value<SpringComponent>();
-			if (s.objects[0] == n || s.objects[1] == n)
-				e->destroy();
-		}
-	}
-
 	Vec3 screenToWorld(Vec2 p)
 	{
 		return terrainIntersection(cameraRay(engineEntities()->get(cameraName), p));
 	}
 
+	// the press is applied in the next update, so that it can be recorded and replayed with the other input
 	bool mousePress(InputMouse in)
 	{
 		if (in.buttons == MouseButtonsFlags::Left && in.mods == ModifiersFlags::None)
 		{
-			TransformComponent &ht = engineEntities()->get(characterHands[currentHand])->value<TransformComponent>();
-			Entity *clinch = findClinch(ht.position, 3);
-			if (clinch)
-			{
-				uint32 clinchName = clinch->name();
-				for (uint32 i = 0; i < characterHandsCount; i++)
-				{
-					SpringComponent &s = engineEntities()->get(characterHandJoints[i])->value<SpringComponent>();
-					if (s.objects[1] == clinchName)
-						return true; // do not allow multiple hands on single clinch
-				}
-				{ // attach current hand to the clinch
-					SpringComponent &s = engineEntities()->get(characterHandJoints[currentHand])->value<SpringComponent>();
-					s.objects[1] = clinchName;
-				}
-				currentHand = (currentHand + 1) % characterHandsCount;
-				{ // free another hand
-					SpringComponent &s = engineEntities()->get(characterHandJoints[currentHand])->value<SpringComponent>();
-					s.objects[1] = cursorName;
-				}
-			}
+			clinchRequested = true;
 			return true;
 		}
 		return false;
 	}
 
+	void clinchHand()
+	{
+		TransformComponent &ht = engineEntities()->get(characterHands[currentHand])->value<TransformComponent>();
+		Entity *clinch = findClinch(ht.position, 3);
+		if (!clinch)
+			return;
+		uint32 clinchName = clinch->name();
+		if (!springsOf(clinchName).empty())
+			return; // do not allow multiple hands on single clinch, nothing else attaches to clinches
+		// attach current hand to the clinch
+		springRetarget(engineEntities()->get(characterHandJoints[currentHand]), 1, clinchName);
+		currentHand = (currentHand + 1) % characterHandsCount;
+		// free another hand
+		springRetarget(engineEntities()->get(characterHandJoints[currentHand]), 1, cursorName);
+	}
+
 	bool initializeTheGame()
 	{
 		std::vector<Entity*> clinches;
@@ -195,13 +168,13 @@ namespace
 					else
 						jointHandClinch(i, clinches[i]->name());
 				}
-				addSpring(characterBody, characterShoulders[i], 4, 0.05, 0.1);
+				springCreate(characterBody, characterShoulders[i], 4, 0.05, 0.1);
 				{
-					Entity *e = addSpring(characterShoulders[i], characterElbows[i], 7, 0.05, 0.1);
+					Entity *e = springCreate(characterShoulders[i], characterElbows[i], 7, 0.05, 0.1);
 					e->value<SpringVisualComponent>().color = colorDeviation(colorIndex(i), 0.1);
 				}
 				{
-					Entity *e = addSpring(characterElbows[i], characterHands[i], 10, 0.05, 0.1);
+					Entity *e = springCreate(characterElbows[i], characterHands[i], 10, 0.05, 0.1);
 					e->value<SpringVisualComponent>().color = colorDeviation(colorIndex(i), 0.1);
 				}
 			}
@@ -212,6 +185,8 @@ namespace
 	}
 
 	const auto engineUpdateListener = controlThread().update.listen([]() {
+		if (replayHolding())
+			return;
 		if (!characterBody)
 		{
 			if (!initializeTheGame())
@@ -228,9 +203,17 @@ namespace
 				playerPosition = Vec3::Nan();
 		}
 
+		Vec3 target = screenToWorld(engineWindow()->mousePosition());
+		{ // input
+			bool clinch = clinchRequested;
+			clinchRequested = false;
+			replayInput(target, clinch);
+			if (clinch)
+				clinchHand();
+		}
+
 		{ // cursor
 			TransformComponent &bt = engineEntities()->get(characterBody)->value<TransformComponent>();
-			Vec3 target = screenToWorld(engineWindow()->mousePosition());
 			if (target.valid())
 			{
 				static const Real maxBodyCursorDistance = 30;
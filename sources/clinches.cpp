@@ -11,6 +11,7 @@
 #include <cage-simple/engine.h>
 
 #include <vector>
+#include <unordered_map>
 #include <algorithm>
 
 namespace
@@ -19,6 +20,26 @@ namespace
 
 	Holder<SpatialStructure> spatialSearchData;
 	Holder<SpatialQuery> spatialSearchQuery;
+	std::unordered_map<uint32, Vec3> clinchPositions; // clinches in the spatial structure, which does not return the stored shapes, clinches do not move
+	bool spatialDirty = false; // the rebuild is deferred until the next search
+
+	void prepareSearch()
+	{
+		if (!spatialDirty)
+			return;
+		spatialSearchData->rebuild();
+		spatialDirty = false;
+	}
+
+	// distances of the found clinches to the position, resolved once instead of in every comparison
+	std::vector<std::pair<Real, uint32>> clinchDistances(PointerRange<const uint32> names, const Vec3 &pos)
+	{
+		std::vector<std::pair<Real, uint32>> result;
+		result.reserve(names.size());
+		for (uint32 name : names)
+			result.emplace_back(distance(clinchPositions.at(name), pos), name);
+		return result;
+	}
 
 	struct Tile
 	{
@@ -46,15 +67,30 @@ namespace
 			tr.position = Vec3(pos, terrainOffset(pos) + ClinchTerrainOffset);
 			RenderComponent &r = e->value<RenderComponent>();
 			r.object = HashString("cragsman/clinch/clinch.object");
+			spatialSearchData->update(e->name(), Sphere(tr.position, 1));
+			clinchPositions[e->name()] = tr.position;
+		}
+		spatialDirty = true;
+	}
+
+	void removeClinches(const Tile &t)
+	{
+		for (Entity *e : t.clinches)
+		{
+			spatialSearchData->remove(e->name());
+			clinchPositions.erase(e->name());
 		}
+		spatialDirty |= !t.clinches.empty();
 	}
 
 	const auto engineUpdateListener = controlThread().update.listen([]() {
-		bool changes = false;
+		if (replayHolding())
+			return;
 		{ // remove unneeded tiles
 			tiles.erase(std::remove_if(tiles.begin(), tiles.end(), [&](const Tile &t) {
 				bool r = t.distanceToPlayer() > 400;
-				changes |= r;
+				if (r)
+					removeClinches(t);
 				return r;
 			}), tiles.end());
 		}
@@ -68,22 +104,6 @@ namespace
 				t.pos = n;
 				generateClinches(t);
 				tiles.push_back(std::move(t));
-				changes = true;
-			}
-		}
-		{ // update spatial
-			if (changes)
-			{
-				spatialSearchData->clear();
-				for (Tile &t : tiles)
-				{
-					for (Entity *e : t.clinches)
-					{
-						TransformComponent &tr = e->value<TransformComponent>();
-						spatialSearchData->update(e->name(), Sphere(tr.position, 1));
-					}
-				}
-				spatialSearchData->rebuild();
 			}
 		}
 	});
@@ -92,10 +112,17 @@ namespace
 		spatialSearchData = newSpatialStructure({});
 		spatialSearchQuery = newSpatialQuery(spatialSearchData.share());
 	});
+
+	const auto engineFinalizeListener = controlThread().finalize.listen([]() {
+		tiles.clear();
+		clinchPositions.clear();
+		spatialDirty = false;
+	});
 }
 
 void findInitialClinches(uint32 &count, Entity **result)
 {
+	prepareSearch();
 	spatialSearchQuery->intersection(Aabb::Universe());
 	auto res = spatialSearchQuery->result();
 	if (res.size() < count)
@@ -103,29 +130,19 @@ void findInitialClinches(uint32 &count, Entity **result)
 		count = 0;
 		return;
 	}
-	std::sort(res.begin(), res.end(), [](uint32 a, uint32 b) {
-		TransformComponent &ta = engineEntities()->get(a)->value<TransformComponent>();
-		TransformComponent &tb = engineEntities()->get(b)->value<TransformComponent>();
-		Real da = distance(ta.position, Vec3());
-		Real db = distance(tb.position, Vec3());
-		return da < db;
-	});
+	auto ds = clinchDistances(res, Vec3());
+	std::sort(ds.begin(), ds.end());
 	for (uint32 i = 0; i < count; i++)
-		result[i] = engineEntities()->get(res[i]);
+		result[i] = engineEntities()->get(ds[i].second);
 }
 
 Entity *findClinch(const Vec3 &pos, Real maxDist)
 {
+	prepareSearch();
 	spatialSearchQuery->intersection(Sphere(pos, maxDist));
 	auto res = spatialSearchQuery->result();
 	if (!res.size())
 		return nullptr;
-	uint32 n = *std::min_element(res.begin(), res.end(), [pos](uint32 a, uint32 b) {
-		TransformComponent &ta = engineEntities()->get(a)->value<TransformComponent>();
-		TransformComponent &tb = engineEntities()->get(b)->value<TransformComponent>();
-		Real da = distance(ta.position, pos);
-		Real db = distance(tb.position, pos);
-		return da < db;
-	});
-	return engineEntities()->get(n);
+	const auto ds = clinchDistances(res, pos);
+	return engineEntities()->get(std::min_element(ds.begin(), ds.end())->second);
 }
@@ -4,6 +4,8 @@
 #include <cage-core/core.h>
 #include <cage-core/math.h>
 
+#include <vector>
+
 namespace cage
 {
 	class Entity;
@@ -12,13 +14,66 @@ namespace cage
 
 using namespace cage;
 
+enum class TerrainLayerEnum : uint32
+{
+	BasesWeights, // color encodes indices of the two strongest bases and their blend
+	BasePaper,
+	BaseSphinx,
+	BaseWhite,
+	BaseDarkRock1,
+	BaseDarkRock2,
+};
+
+class TerrainGenerator : private Immovable
+{
+public:
+	Real offset(const Vec2 &position) const;
+	Real offset(const Vec2 &position, Vec2 &gradient) const;
+	void offset(PointerRange<const Vec2> positions, PointerRange<Real> results) const;
+	void offset(PointerRange<const Vec2> positions, PointerRange<Real> results, PointerRange<Vec2> gradients) const;
+	void material(const Vec2 &position, Vec3 &color, Real &roughness, Real &metallic, bool rockOnly) const;
+	// layers of low frequency are interpolated from coarse lattices with the given error tolerance, zero means exact evaluation
+	void material(PointerRange<const Vec2> positions, PointerRange<Vec3> colors, PointerRange<Real> roughness, PointerRange<Real> metallic, bool rockOnly, Real tolerance) const;
+	// largest difference of the coarse lattices, built for the positions, from the exact evaluation, for testing
+	Real coarseFieldsError(PointerRange<const Vec2> positions, Real tolerance, uint32 &fieldsCount) const;
+	// evaluates a single layer of the material, for profiling and debugging
+	void layer(TerrainLayerEnum layer, PointerRange<const Vec2> positions, PointerRange<Vec3> colors, PointerRange<Real> roughness, PointerRange<Real> metallic) const;
+};
+
+// the generator is immutable, one instance may be used from multiple threads concurrently
+Holder<TerrainGenerator> newTerrainGenerator(uint32 seed);
+
 void findInitialClinches(uint32 &count, Entity **result);
 Entity *findClinch(const Vec3 &pos, Real maxDist);
 Real terrainOffset(const Vec2 &position);
+void terrainOffset(PointerRange<const Vec2> positions, PointerRange<Real> results);
+Real terrainOffset(const Vec2 &position, Vec2 &gradient);
+void terrainOffset(PointerRange<const Vec2> positions, PointerRange<Real> results, PointerRange<Vec2> gradients);
 void terrainMaterial(const Vec2 &pos, Vec3 &color, Real &roughness, Real &metallic, bool rockOnly);
+void terrainMaterial(PointerRange<const Vec2> positions, PointerRange<Vec3> colors, PointerRange<Real> roughness, PointerRange<Real> metallic, bool rockOnly, Real tolerance);
 Vec3 terrainIntersection(const Line &ln);
 void addTerrainCollider(uint32 name, Holder<Collider> c);
 void removeTerrainCollider(uint32 name);
+
+// terrain heights sampled on a regular grid covering one tile, physics uses it instead of the triangle colliders
+struct TerrainHeights
+{
+	std::vector<Real> heights; // row major, resolution * resolution
+	Vec2 origin; // world position of the first sample
+	Real spacing; // distance between neighboring samples
+	Real tileLength; // the tile owns positions in [tile, tile + 1) * tileLength
+	sint32 tileX = 0, tileY = 0;
+	uint32 resolution = 0;
+
+	// min (x) and max (y) heights of blocks of grid cells, used to skip the blocks that a ray passes above or below
+	// the first level has one block per cell, each next level merges 2 x 2 blocks, the last level is a single block
+	std::vector<std::vector<Vec2>> pyramid;
+
+	void buildPyramid(); // after the heights are filled in
+};
+
+void addTerrainHeights(uint32 name, Holder<const TerrainHeights> heights);
+void removeTerrainHeights(uint32 name);
 Real sphereVolume(Real radius);
 Vec3 colorDeviation(const Vec3 &color, Real deviation);
 Quat sunLightOrientation(const Vec2 &playerPosition);
@@ -28,6 +83,9 @@ struct PhysicsComponent
 	Vec3 velocity;
 	Real mass;
 	Real collisionRadius;
+	uint32 restingUpdates; // consecutive updates with low velocity, maintained by the simulation
+	bool wake; // wakes the group of the body in the next update, cleared by the simulation
+	PhysicsComponent();
 };
 
 struct SpringComponent
@@ -36,19 +94,76 @@ struct SpringComponent
 	Real restDistance;
 	Real stiffness;
 	Real damping;
+	Real sleepLength; // length when its bodies fell asleep, maintained by the simulation
 	SpringComponent();
 };
 
-struct SpringVisualComponent
+// the springs must be created, retargeted and destroyed with these functions, which maintain the index of the springs attached to each body
+Entity *springCreate(uint32 a, uint32 b, Real restDistance, Real stiffness, Real damping);
+void springRetarget(Entity *spring, uint32 end, uint32 body);
+void springDestroy(Entity *spring);
+void springsDestroy(uint32 body); // all springs attached to the body
+PointerRange<Entity *const> springsOf(uint32 body);
+
+enum class PhysicsPhaseEnum : uint32
 {
-	Vec3 color;
-	SpringVisualComponent();
+	Sync, // gathering the entities and writing them back
+	Load, // sleeping and adjacency
+	Contacts, // between bodies
+	Terrain, // batched terrain collider queries
+	Springs,
+	Bodies,
+	Predict,
+	Constraints,
+	Corrections,
+	Store, // resting counters
+	Count,
+};
+
+constexpr const char *PhysicsPhaseNames[(uint32)PhysicsPhaseEnum::Count] = { "sync", "load", "contacts", "terrain", "springs", "bodies", "predict", "constraints", "corrections", "store" };
+
+struct PhysicsStatistics
+{
+	uint64 phaseTimes[(uint32)PhysicsPhaseEnum::Count] = {}; // nanoseconds, summed over the steps of the last physics update
+	uint32 activeBodies = 0;
+	uint32 sleepingBodies = 0;
+	uint32 contactPairs = 0; // touching pairs of bodies, summed over the steps
+	uint32 terrainContacts = 0; // terrain triangles near the bodies, or bodies touching the heightfield, summed over the steps
+	uint32 wallCorrections = 0; // bodies found behind the terrain and moved in front of it, summed over the steps
+	uint64 updateTime = 0; // microseconds spent in the last physics update
+};
+
+PhysicsStatistics physicsStatistics();
+
+// particles of the spring visuals, pooled outside of the entities
+void particlesEmit(const Vec3 &position, const Vec3 &velocity, const Vec3 &color, uint32 ttl, bool light);
+
+struct ParticlesStatistics
+{
+	uint32 alive = 0;
+	uint32 emitted = 0; // in the last update
+	uint32 lightCandidates = 0; // particles that emit light
+	uint32 lights = 0; // lights in the scene after merging and the budget
+	uint64 updateTime = 0; // microseconds spent in the last update of the particles
 };
 
-struct TimeoutComponent
+ParticlesStatistics particlesStatistics();
+
+// deterministic recording of a session and its headless replay, which reports the performance
+void replayInitialize(const String &recordPath, const String &replayPath);
+void replayInput(Vec3 &cursor, bool &clinch); // records the input of the current update, or replaces it with the recorded one
+void replayTileLatency(uint64 microseconds);
+void replayTileRegistered(const Vec2i &tile); // records that the collider of the tile became available to the physics in the current update
+bool replayTilesExpected(std::vector<Vec2i> &tiles); // tiles registered in the current update of the recording, returns false when not replaying
+bool replayDiverged(); // the final player position differs from the recording, or the terrain tiles were not generated in time
+bool replayHolding(); // the replay waits for terrain tiles, listeners that change the game must skip the update
+bool terrainTilesGenerated(PointerRange<const Vec2i> tiles); // the colliders of the tiles are generated and may be registered
+uint64 gameUpdatePeriod(); // simulated duration of one update, independent of the pacing of the replay
+
+struct SpringVisualComponent
 {
-	uint32 ttl;
-	TimeoutComponent();
+	Vec3 color;
+	SpringVisualComponent();
 };
 
 extern uint32 cameraName;
@@ -2,6 +2,7 @@
 
 #include <cage-core/entities.h>
 #include <cage-core/hashString.h>
+#include <cage-core/config.h>
 
 #include <cage-engine/scene.h>
 #include <cage-engine/guiBuilder.h>
@@ -11,12 +12,47 @@ namespace
 {
 	sint32 bestScore;
 
+	// shows the physics update time, its counters, the times of its phases, and the cost of the particles
+	ConfigBool physicsProfile("cragsman/physics/profile", false);
+	bool profileShown = false;
+
+	// names of the gui entities with the values
+	enum GuiNameEnum : uint32
+	{
+		BestScoreName = 1,
+		CurrentScoreName,
+		ActiveBodiesName,
+		SleepingBodiesName,
+		PhysicsUpdateName,
+		ContactPairsName,
+		TerrainContactsName,
+		ParticlesName,
+		ParticlesUpdateName,
+		ParticleLightsName,
+		PhysicsPhasesName, // one per phase
+	};
+
 	const auto engineUpdateListener = controlThread().update.listen([]() {
 		sint32 currentScore = numeric_cast<sint32>(playerPosition[1] * 0.1);
 		bestScore = max(currentScore, bestScore);
 		EntityManager *ents = engineGuiEntities();
-		ents->get(1)->value<GuiTextComponent>().value = Stringizer() + bestScore;
-		ents->get(2)->value<GuiTextComponent>().value = Stringizer() + currentScore;
+		ents->get(BestScoreName)->value<GuiTextComponent>().value = Stringizer() + bestScore;
+		ents->get(CurrentScoreName)->value<GuiTextComponent>().value = Stringizer() + currentScore;
+		const PhysicsStatistics ps = physicsStatistics();
+		ents->get(ActiveBodiesName)->value<GuiTextComponent>().value = Stringizer() + ps.activeBodies;
+		ents->get(SleepingBodiesName)->value<GuiTextComponent>().value = Stringizer() + ps.sleepingBodies;
+		if (profileShown)
+		{
+			ents->get(PhysicsUpdateName)->value<GuiTextComponent>().value = Stringizer() + ps.updateTime + " us";
+			ents->get(ContactPairsName)->value<GuiTextComponent>().value = Stringizer() + ps.contactPairs;
+			ents->get(TerrainContactsName)->value<GuiTextComponent>().value = Stringizer() + ps.terrainContacts;
+			for (uint32 i = 0; i < (uint32)PhysicsPhaseEnum::Count; i++)
+				ents->get(PhysicsPhasesName + i)->value<GuiTextComponent>().value = Stringizer() + (ps.phaseTimes[i] / 1000) + " us";
+			const ParticlesStatistics pa = particlesStatistics();
+			ents->get(ParticlesName)->value<GuiTextComponent>().value = Stringizer() + pa.alive + " (+" + pa.emitted + ")";
+			ents->get(ParticlesUpdateName)->value<GuiTextComponent>().value = Stringizer() + pa.updateTime + " us";
+			ents->get(ParticleLightsName)->value<GuiTextComponent>().value = Stringizer() + pa.lights + " of " + pa.lightCandidates;
+		}
 	});
 
 	const auto engineInitListener = controlThread().initialize.listen([]() {
@@ -25,8 +61,33 @@ namespace
 		auto _2 = g->panel();
 		auto _3 = g->verticalTable(2);
 		g->label().text("Best Score: ");
-		g->setNextName(1).label().text("");
+		g->setNextName(BestScoreName).label().text("");
 		g->label().text("Current Score: ");
-		g->setNextName(2).label().text("");
+		g->setNextName(CurrentScoreName).label().text("");
+		g->label().text("Active Bodies: ");
+		g->setNextName(ActiveBodiesName).label().text("");
+		g->label().text("Sleeping Bodies: ");
+		g->setNextName(SleepingBodiesName).label().text("");
+		profileShown = physicsProfile;
+		if (profileShown)
+		{
+			g->label().text("Physics Update: ");
+			g->setNextName(PhysicsUpdateName).label().text("");
+			g->label().text("Contact Pairs: ");
+			g->setNextName(ContactPairsName).label().text("");
+			g->label().text("Terrain Contacts: ");
+			g->setNextName(TerrainContactsName).label().text("");
+			g->label().text("Particles: ");
+			g->setNextName(ParticlesName).label().text("");
+			g->label().text("Particles Update: ");
+			g->setNextName(ParticlesUpdateName).label().text("");
+			g->label().text("Particle Lights: ");
+			g->setNextName(ParticleLightsName).label().text("");
+			for (uint32 i = 0; i < (uint32)PhysicsPhaseEnum::Count; i++)
+			{
+				g->label().text(Stringizer() + "Physics " + PhysicsPhaseNames[i] + ": ");
+				g->setNextName(PhysicsPhasesName + i).label().text("");
+			}
+		}
 	});
 }
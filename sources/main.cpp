@@ -1,3 +1,5 @@
+#include "common.h"
+
 #include <cage-core/core.h>
 #include <cage-core/logger.h>
 #include <cage-core/math.h>
@@ -31,8 +33,14 @@ int main(int argc, const char *args[])
 		log1->format.bind<logFormatConsole>();
 		log1->output.bind<logOutputStdOut>();
 
+		Holder<Ini> cmd = newIni();
+		cmd->parseCmd(argc, args);
+		const String recordPath = cmd->cmdString('r', "record", "");
+		const String replayPath = cmd->cmdString('p', "replay", "");
+
 		engineInitialize(EngineCreateConfig());
 		controlThread().updatePeriod(1000000 / 30);
+		replayInitialize(recordPath, replayPath);
 		engineAssets()->add(HashString("cragsman/cragsman.pack"));
 
 		const auto closeListener = engineWindow()->events.listen(inputListener<InputClassEnum::WindowClose, InputWindow>(&windowClose));
@@ -49,7 +57,7 @@ int main(int argc, const char *args[])
 
 		engineAssets()->remove(HashString("cragsman/cragsman.pack"));
 		engineFinalize();
-		return 0;
+		return replayDiverged() ? 1 : 0;
 	}
 	catch (...)
 	{
@@ -0,0 +1,478 @@
+#ifndef cragsman_noise_h_f4g5s6d8t7
+#define cragsman_noise_h_f4g5s6d8t7
+
+#include "common.h"
+
+#include <cage-core/noiseFunction.h>
+
+#include <cmath>
+
+// inlineable noise primitives for the procedural generation
+// the algorithms follow the value and cellular noise of the NoiseFunction, but everything is visible to the compiler
+// so that the whole terrain composition can be inlined, constant-folded and vectorized
+
+// functions marked with this are compiled for multiple instruction sets and the best one is picked at load time
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define NOISE_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define NOISE_TARGET_CLONES
+#endif
+
+namespace noise
+{
+	constexpr uint32 PrimeX = 501125321u;
+	constexpr uint32 PrimeY = 1136930381u;
+	constexpr uint32 PrimeZ = 1720413743u;
+
+	inline float min(float a, float b)
+	{
+		return a < b ? a : b;
+	}
+
+	inline float max(float a, float b)
+	{
+		return a > b ? a : b;
+	}
+
+	inline float clamp(float v, float a, float b)
+	{
+		return min(max(v, a), b);
+	}
+
+	inline float pow(float v, float e)
+	{
+		return std::pow(v, e);
+	}
+
+	inline float sin(float v)
+	{
+		return std::sin(v);
+	}
+
+	inline float mod(float v, float m)
+	{
+		return std::fmod(v, m);
+	}
+
+	inline float lerp(float a, float b, float f)
+	{
+		return a + (b - a) * f;
+	}
+
+	// value with its derivatives along the two horizontal axes
+	// the terrain kernel instantiated with this type yields exact slopes from a single evaluation
+	struct Grad2
+	{
+		float v = 0;
+		float dx = 0;
+		float dy = 0;
+	};
+
+	inline Grad2 operator + (Grad2 a, Grad2 b) { return { a.v + b.v, a.dx + b.dx, a.dy + b.dy }; }
+	inline Grad2 operator - (Grad2 a, Grad2 b) { return { a.v - b.v, a.dx - b.dx, a.dy - b.dy }; }
+	inline Grad2 operator * (Grad2 a, Grad2 b) { return { a.v * b.v, a.dx * b.v + a.v * b.dx, a.dy * b.v + a.v * b.dy }; }
+	inline Grad2 operator + (Grad2 a, float b) { return { a.v + b, a.dx, a.dy }; }
+	inline Grad2 operator - (Grad2 a, float b) { return { a.v - b, a.dx, a.dy }; }
+	inline Grad2 operator * (Grad2 a, float b) { return { a.v * b, a.dx * b, a.dy * b }; }
+	inline Grad2 operator / (Grad2 a, float b) { return { a.v / b, a.dx / b, a.dy / b }; }
+	inline Grad2 &operator += (Grad2 &a, Grad2 b) { return a = a + b; }
+	inline bool operator < (Grad2 a, float b) { return a.v < b; }
+	inline bool operator > (Grad2 a, float b) { return a.v > b; }
+
+	inline Grad2 min(Grad2 a, Grad2 b)
+	{
+		return a.v < b.v ? a : b;
+	}
+
+	inline Grad2 min(Grad2 a, float b)
+	{
+		return a.v < b ? a : Grad2{ b };
+	}
+
+	inline Grad2 clamp(Grad2 v, float a, float b)
+	{
+		if (v.v < a)
+			return { a };
+		if (v.v > b)
+			return { b };
+		return v;
+	}
+
+	inline Grad2 pow(Grad2 v, float e)
+	{
+		const float p = std::pow(v.v, e);
+		const float d = v.v > 0 ? e * p / v.v : 0;
+		return { p, v.dx * d, v.dy * d };
+	}
+
+	inline Grad2 sin(Grad2 v)
+	{
+		const float c = std::cos(v.v);
+		return { std::sin(v.v), v.dx * c, v.dy * c };
+	}
+
+	inline Grad2 mod(Grad2 v, float m)
+	{
+		return { std::fmod(v.v, m), v.dx, v.dy };
+	}
+
+	// combines derivatives of a noise with respect to its inputs with the derivatives of the inputs themselves
+	inline Grad2 chain(float value, float du, float dv, Grad2 u, Grad2 v)
+	{
+		return { value, du * u.dx + dv * v.dx, du * u.dy + dv * v.dy };
+	}
+
+	inline sint32 fastFloor(float v)
+	{
+		const sint32 i = (sint32)v;
+		return i - (sint32)(v < (float)i);
+	}
+
+	inline sint32 fastRound(float v)
+	{
+		return fastFloor(v + 0.5f);
+	}
+
+	inline float hermite(float t)
+	{
+		return t * t * (3 - 2 * t);
+	}
+
+	inline float hermiteDerivative(float t)
+	{
+		return 6 * t * (1 - t);
+	}
+
+	inline uint32 hashCoord(uint32 seed, uint32 xp, uint32 yp)
+	{
+		return (seed ^ xp ^ yp) * 0x27d4eb2du;
+	}
+
+	inline uint32 hashCoord(uint32 seed, uint32 xp, uint32 yp, uint32 zp)
+	{
+		return (seed ^ xp ^ yp ^ zp) * 0x27d4eb2du;
+	}
+
+	// uniform value in -1 .. 1
+	inline float hashValue(uint32 h)
+	{
+		h *= h;
+		h ^= h << 19;
+		return (float)(sint32)h * (1.f / 2147483648.f);
+	}
+
+	// offsets of the feature points of the cellular noise of the NoiseFunction, already scaled by its jitter
+	// the library does not expose its table of random vectors, it is recovered from the library when first needed
+	struct CellOffsets
+	{
+		float vecs2[512] = {}; // pairs indexed by the cell hash & 510
+		float vecs3[1024] = {}; // quadruples indexed by the cell hash & 1020, the last one is unused
+	};
+
+	const CellOffsets &cellOffsets();
+
+	inline float value(uint32 seed, float x, float y)
+	{
+		const sint32 x0 = fastFloor(x);
+		const sint32 y0 = fastFloor(y);
+		const float xs = hermite(x - (float)x0);
+		const float ys = hermite(y - (float)y0);
+		const uint32 xp0 = (uint32)x0 * PrimeX;
+		const uint32 yp0 = (uint32)y0 * PrimeY;
+		const uint32 xp1 = xp0 + PrimeX;
+		const uint32 yp1 = yp0 + PrimeY;
+		const float xf0 = lerp(hashValue(hashCoord(seed, xp0, yp0)), hashValue(hashCoord(seed, xp1, yp0)), xs);
+		const float xf1 = lerp(hashValue(hashCoord(seed, xp0, yp1)), hashValue(hashCoord(seed, xp1, yp1)), xs);
+		return lerp(xf0, xf1, ys);
+	}
+
+	inline float value(uint32 seed, float x, float y, float &dx, float &dy)
+	{
+		const sint32 x0 = fastFloor(x);
+		const sint32 y0 = fastFloor(y);
+		const float xt = x - (float)x0;
+		const float yt = y - (float)y0;
+		const float xs = hermite(xt);
+		const float ys = hermite(yt);
+		const uint32 xp0 = (uint32)x0 * PrimeX;
+		const uint32 yp0 = (uint32)y0 * PrimeY;
+		const uint32 xp1 = xp0 + PrimeX;
+		const uint32 yp1 = yp0 + PrimeY;
+		const float a = hashValue(hashCoord(seed, xp0, yp0));
+		const float b = hashValue(hashCoord(seed, xp1, yp0));
+		const float c = hashValue(hashCoord(seed, xp0, yp1));
+		const float d = hashValue(hashCoord(seed, xp1, yp1));
+		const float xf0 = lerp(a, b, xs);
+		const float xf1 = lerp(c, d, xs);
+		dx = lerp(b - a, d - c, ys) * hermiteDerivative(xt);
+		dy = (xf1 - xf0) * hermiteDerivative(yt);
+		return lerp(xf0, xf1, ys);
+	}
+
+	inline float value(uint32 seed, float x, float y, float z)
+	{
+		const sint32 x0 = fastFloor(x);
+		const sint32 y0 = fastFloor(y);
+		const sint32 z0 = fastFloor(z);
+		const float xs = hermite(x - (float)x0);
+		const float ys = hermite(y - (float)y0);
+		const float zs = hermite(z - (float)z0);
+		const uint32 xp0 = (uint32)x0 * PrimeX;
+		const uint32 yp0 = (uint32)y0 * PrimeY;
+		const uint32 zp0 = (uint32)z0 * PrimeZ;
+		const uint32 xp1 = xp0 + PrimeX;
+		const uint32 yp1 = yp0 + PrimeY;
+		const uint32 zp1 = zp0 + PrimeZ;
+		const float xf00 = lerp(hashValue(hashCoord(seed, xp0, yp0, zp0)), hashValue(hashCoord(seed, xp1, yp0, zp0)), xs);
+		const float xf10 = lerp(hashValue(hashCoord(seed, xp0, yp1, zp0)), hashValue(hashCoord(seed, xp1, yp1, zp0)), xs);
+		const float xf01 = lerp(hashValue(hashCoord(seed, xp0, yp0, zp1)), hashValue(hashCoord(seed, xp1, yp0, zp1)), xs);
+		const float xf11 = lerp(hashValue(hashCoord(seed, xp0, yp1, zp1)), hashValue(hashCoord(seed, xp1, yp1, zp1)), xs);
+		const float yf0 = lerp(xf00, xf10, ys);
+		const float yf1 = lerp(xf01, xf11, ys);
+		return lerp(yf0, yf1, zs);
+	}
+
+	constexpr float fractalBounding(uint32 octaves)
+	{
+		float amp = 1, sum = 0;
+		for (uint32 i = 0; i < octaves; i++)
+		{
+			sum += amp;
+			amp *= 0.5f;
+		}
+		return octaves ? 1 / sum : 1;
+	}
+
+	// bound of the second derivative of the fractal along any axis
+	// value noise contributes at most 6 (hermite) times 2 (range of values) per octave, scaled by its amplitude and squared frequency
+	constexpr float fractalCurvature(uint32 octaves)
+	{
+		if (octaves == 0)
+			return 12;
+		float amp = fractalBounding(octaves), freq2 = 1, sum = 0;
+		for (uint32 i = 0; i < octaves; i++)
+		{
+			sum += 12 * amp * freq2;
+			amp *= 0.5f;
+			freq2 *= 4;
+		}
+		return sum;
+	}
+
+	// value noise with fbm fractal, zero octaves is plain value noise
+	template<uint32 Octaves>
+	struct Clouds
+	{
+		static constexpr float Bounding = fractalBounding(Octaves);
+		static constexpr float Curvature = fractalCurvature(Octaves);
+
+		uint32 seed = 0;
+
+		float evaluate(float x, float y) const
+		{
+			if constexpr (Octaves == 0)
+				return value(seed, x, y);
+			float sum = 0, amp = Bounding;
+			for (uint32 i = 0; i < Octaves; i++)
+			{
+				sum += value(seed + i, x, y) * amp;
+				x *= 2;
+				y *= 2;
+				amp *= 0.5f;
+			}
+			return sum;
+		}
+
+		Grad2 evaluate(Grad2 x, Grad2 y) const
+		{
+			constexpr uint32 cnt = Octaves ? Octaves : 1;
+			float sum = 0, du = 0, dv = 0, amp = Bounding, freq = 1;
+			for (uint32 i = 0; i < cnt; i++)
+			{
+				float gx, gy;
+				sum += value(seed + i, x.v * freq, y.v * freq, gx, gy) * amp;
+				du += gx * amp * freq;
+				dv += gy * amp * freq;
+				freq *= 2;
+				amp *= 0.5f;
+			}
+			return chain(sum, du, dv, x, y);
+		}
+
+		float evaluate(float x, float y, float z) const
+		{
+			if constexpr (Octaves == 0)
+				return value(seed, x, y, z);
+			float sum = 0, amp = Bounding;
+			for (uint32 i = 0; i < Octaves; i++)
+			{
+				sum += value(seed + i, x, y, z) * amp;
+				x *= 2;
+				y *= 2;
+				z *= 2;
+				amp *= 0.5f;
+			}
+			return sum;
+		}
+	};
+
+	// cellular noise with euclidean distance
+	template<NoiseOperationEnum Operation>
+	struct Cell
+	{
+		static_assert(Operation == NoiseOperationEnum::Distance || Operation == NoiseOperationEnum::Distance2 || Operation == NoiseOperationEnum::Subtract);
+
+		uint32 seed = 0;
+		const CellOffsets *offsets = &cellOffsets();
+
+		static float finish(float d0, float d1)
+		{
+			d0 = std::sqrt(d0);
+			d1 = std::sqrt(d1);
+			switch (Operation)
+			{
+			case NoiseOperationEnum::Distance: return d0 - 1;
+			case NoiseOperationEnum::Distance2: return d1 - 1;
+			default: return d1 - d0 - 1;
+			}
+		}
+
+		float evaluate(float x, float y) const
+		{
+			const sint32 xr = fastRound(x) - 1;
+			const sint32 yr = fastRound(y) - 1;
+			float d0 = 1e10f, d1 = 1e10f;
+			for (uint32 i = 0; i < 3; i++)
+			{
+				const sint32 xi = xr + (sint32)i;
+				for (uint32 j = 0; j < 3; j++)
+				{
+					const sint32 yi = yr + (sint32)j;
+					const uint32 h = hashCoord(seed, (uint32)xi * PrimeX, (uint32)yi * PrimeY) & (255 << 1);
+					const float vx = (float)xi - x + offsets->vecs2[h];
+					const float vy = (float)yi - y + offsets->vecs2[h | 1];
+					const float d = vx * vx + vy * vy;
+					d1 = max(min(d1, d), d0);
+					d0 = min(d0, d);
+				}
+			}
+			return finish(d0, d1);
+		}
+
+		Grad2 evaluate(Grad2 gx, Grad2 gy) const
+		{
+			const float x = gx.v, y = gy.v;
+			const sint32 xr = fastRound(x) - 1;
+			const sint32 yr = fastRound(y) - 1;
+			float d0 = 1e10f, d1 = 1e10f;
+			float v0x = 0, v0y = 0, v1x = 0, v1y = 0; // vectors towards the two closest feature points
+			for (uint32 i = 0; i < 3; i++)
+			{
+				const sint32 xi = xr + (sint32)i;
+				for (uint32 j = 0; j < 3; j++)
+				{
+					const sint32 yi = yr + (sint32)j;
+					const uint32 h = hashCoord(seed, (uint32)xi * PrimeX, (uint32)yi * PrimeY) & (255 << 1);
+					const float vx = (float)xi - x + offsets->vecs2[h];
+					const float vy = (float)yi - y + offsets->vecs2[h | 1];
+					const float d = vx * vx + vy * vy;
+					if (d < d0)
+					{
+						d1 = d0;
+						v1x = v0x;
+						v1y = v0y;
+						d0 = d;
+						v0x = vx;
+						v0y = vy;
+					}
+					else if (d < d1)
+					{
+						d1 = d;
+						v1x = vx;
+						v1y = vy;
+					}
+				}
+			}
+			const float value = finish(d0, d1);
+			// moving the position towards a feature point shortens the distance to it
+			const float l0 = std::sqrt(d0);
+			const float l1 = std::sqrt(d1);
+			const float g0x = l0 > 0 ? -v0x / l0 : 0, g0y = l0 > 0 ? -v0y / l0 : 0;
+			const float g1x = l1 > 0 ? -v1x / l1 : 0, g1y = l1 > 0 ? -v1y / l1 : 0;
+			switch (Operation)
+			{
+			case NoiseOperationEnum::Distance: return chain(value, g0x, g0y, gx, gy);
+			case NoiseOperationEnum::Distance2: return chain(value, g1x, g1y, gx, gy);
+			default: return chain(value, g1x - g0x, g1y - g0y, gx, gy);
+			}
+		}
+
+		float evaluate(float x, float y, float z) const
+		{
+			const sint32 xr = fastRound(x) - 1;
+			const sint32 yr = fastRound(y) - 1;
+			const sint32 zr = fastRound(z) - 1;
+			float d0 = 1e10f, d1 = 1e10f;
+			for (uint32 i = 0; i < 3; i++)
+			{
+				const sint32 xi = xr + (sint32)i;
+				for (uint32 j = 0; j < 3; j++)
+				{
+					const sint32 yi = yr + (sint32)j;
+					for (uint32 k = 0; k < 3; k++)
+					{
+						const sint32 zi = zr + (sint32)k;
+						const uint32 h = hashCoord(seed, (uint32)xi * PrimeX, (uint32)yi * PrimeY, (uint32)zi * PrimeZ) & (255 << 2);
+						const float vx = (float)xi - x + offsets->vecs3[h];
+						const float vy = (float)yi - y + offsets->vecs3[h | 1];
+						const float vz = (float)zi - z + offsets->vecs3[h | 2];
+						const float d = vx * vx + vy * vy + vz * vz;
+						d1 = max(min(d1, d), d0);
+						d0 = min(d0, d);
+					}
+				}
+			}
+			return finish(d0, d1);
+		}
+	};
+
+	template<class Noise, class... T>
+	auto evaluateClamp(const Noise &noise, T... position)
+	{
+		return noise.evaluate(position...) * 0.5f + 0.5f;
+	}
+
+	constexpr uint32 SpanSize = 256;
+
+	// structure of arrays of positions processed together
+	struct Span
+	{
+		float x[SpanSize];
+		float y[SpanSize];
+		float z[SpanSize];
+		uint32 count = 0;
+
+		void push(float px, float py, float pz)
+		{
+			CAGE_ASSERT(count < SpanSize);
+			x[count] = px;
+			y[count] = py;
+			z[count] = pz;
+			count++;
+		}
+	};
+
+	template<class T>
+	T rerange(T v, float ia, float ib, float oa, float ob)
+	{
+		return (v - ia) / (ib - ia) * (ob - oa) + oa;
+	}
+
+	template<class T>
+	T sharpEdge(T v)
+	{
+		return rerange(clamp(v, 0.45f, 0.55f), 0.45f, 0.55f, 0, 1);
+	}
+}
+
+#endif // !cragsman_noise_h_f4g5s6d8t7
@@ -0,0 +1,108 @@
+#include "particles.h"
+
+#include <cage-core/entities.h>
+#include <cage-core/hashString.h>
+#include <cage-core/config.h>
+
+#include <cage-engine/scene.h>
+#include <cage-simple/engine.h>
+
+namespace
+{
+	ConfigUint32 particlesCapacity("cragsman/particles/capacity", 2048);
+
+	// particle lights are merged and ranked, and only the most important ones become lights of the scene, so that the cost of lighting is bounded
+	ConfigUint32 particlesLightsBudget("cragsman/particles/lightsBudget", 16);
+	ConfigFloat particlesLightsMerge("cragsman/particles/lightsMerge", 3);
+
+	Holder<ParticlesPool> pool;
+	std::vector<Entity *> slotEntities; // each slot reuses its entity, which has the render component only while the particle is alive
+	std::vector<Entity *> lightEntities; // have the light component only while they are used
+	std::vector<ParticleLight> selectedLights;
+	ParticlesStatistics statistics;
+	uint64 lastEmitted = 0;
+
+	Entity *slotEntity(uint32 i)
+	{
+		if (!slotEntities[i])
+		{
+			slotEntities[i] = engineEntities()->createAnonymous();
+			slotEntities[i]->value<TransformComponent>();
+		}
+		return slotEntities[i];
+	}
+
+	const auto engineUpdateListener = controlThread().update.listen([]() {
+		if (replayHolding())
+			return;
+		const uint64 start = applicationTime();
+		pool->update(gameUpdatePeriod() * 1e-6);
+		const uint32 cap = pool->capacity();
+		for (uint32 i = 0; i < cap; i++)
+		{
+			Entity *e = slotEntities[i];
+			if (!e)
+				continue;
+			if (pool->alive[i])
+				e->value<TransformComponent>().position = pool->positions[i];
+			else if (e->has<RenderComponent>())
+				e->remove<RenderComponent>();
+		}
+		{ // lights
+			const uint32 budget = particlesLightsBudget;
+			statistics.lightCandidates = pool->selectLights(playerPosition.valid() ? playerPosition : Vec3(), budget, max(Real(particlesLightsMerge), Real(0.01)), selectedLights);
+			statistics.lights = numeric_cast<uint32>(selectedLights.size());
+			if (lightEntities.size() < selectedLights.size())
+				lightEntities.resize(selectedLights.size());
+			for (uint32 i = 0; i < lightEntities.size(); i++)
+			{
+				if (i < selectedLights.size())
+				{
+					if (!lightEntities[i])
+						lightEntities[i] = engineEntities()->createAnonymous();
+					Entity *e = lightEntities[i];
+					const ParticleLight &sl = selectedLights[i];
+					e->value<TransformComponent>().position = sl.position;
+					LightComponent &l = e->value<LightComponent>();
+					l.color = sl.color;
+					l.intensity = sl.intensity;
+					l.attenuation = Vec3(0, 0, pool->lightAttenuation);
+				}
+				else if (lightEntities[i] && lightEntities[i]->has<LightComponent>())
+					lightEntities[i]->remove<LightComponent>();
+			}
+		}
+		statistics.alive = pool->aliveCount();
+		statistics.emitted = numeric_cast<uint32>(pool->emitted - lastEmitted);
+		lastEmitted = pool->emitted;
+		statistics.updateTime = applicationTime() - start;
+	});
+
+	const auto engineInitListener = controlThread().initialize.listen([]() {
+		pool = systemMemory().createHolder<ParticlesPool>(max((uint32)particlesCapacity, 1u));
+		slotEntities.resize(pool->capacity());
+	});
+
+	const auto engineFinalizeListener = controlThread().finalize.listen([]() {
+		slotEntities.clear();
+		lightEntities.clear();
+		pool.clear();
+	});
+}
+
+void particlesEmit(const Vec3 &position, const Vec3 &velocity, const Vec3 &color, uint32 ttl, bool light)
+{
+	const uint32 i = pool->emit(position, velocity, color, ttl, light);
+	Entity *e = slotEntity(i);
+	TransformComponent &t = e->value<TransformComponent>();
+	t.position = position;
+	t.orientation = randomDirectionQuat();
+	RenderComponent &r = e->value<RenderComponent>();
+	r.color = color;
+	r.object = HashString("cragsman/particle/particle.object");
+}
+
+ParticlesStatistics particlesStatistics()
+{
+	return statistics;
+}
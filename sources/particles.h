@@ -0,0 +1,60 @@
+#ifndef cragsman_particles_h_f3g4h5j6k7
+#define cragsman_particles_h_f3g4h5j6k7
+
+#include "common.h"
+
+#include <vector>
+
+// light standing for one or more nearby particle lights of similar color
+struct ParticleLight
+{
+	Vec3 position; // weighted by the intensities
+	Vec3 color;
+	Real intensity;
+	Real importance;
+	uint32 count = 0; // merged particles
+};
+
+// fixed capacity ring of short lived particles, kept outside of the entities
+// particles do not collide, they only fall and slow down
+// a new particle takes the oldest slot, which is usually dead already, because all particles live similarly long
+class ParticlesPool : private Immovable
+{
+public:
+	std::vector<Vec3> positions;
+	std::vector<Vec3> velocities;
+	std::vector<Vec3> colors;
+	std::vector<uint32> ttls; // remaining updates, the particle is removed in the update when it is zero
+	std::vector<bool> alive;
+	std::vector<bool> lights; // the particle is a candidate for the lights budget
+	Real lightIntensity = 1.5;
+	Real lightAttenuation = 0.15; // quadratic
+	uint64 emitted = 0;
+	uint64 overwritten = 0; // particles removed before their time to make space for new ones
+
+	explicit ParticlesPool(uint32 capacity);
+
+	uint32 capacity() const
+	{
+		return numeric_cast<uint32>(positions.size());
+	}
+
+	uint32 aliveCount() const
+	{
+		return count;
+	}
+
+	uint32 emit(const Vec3 &position, const Vec3 &velocity, const Vec3 &color, uint32 ttl, bool light); // returns the slot
+	void update(Real deltaTime);
+
+	// merges the lights of alive particles within the same cell of the merge distance and of similar color,
+	// ranks the merged lights by their contribution at the focus, which is in the center of the screen, and keeps the budget most important
+	// returns the number of candidate particle lights
+	uint32 selectLights(const Vec3 &focus, uint32 budget, Real mergeDistance, std::vector<ParticleLight> &result) const;
+
+private:
+	uint32 next = 0;
+	uint32 count = 0;
+};
+
+#endif // !cragsman_particles_h_f3g4h5j6k7
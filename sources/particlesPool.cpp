@@ -0,0 +1,104 @@
+#include "particles.h"
+#include "physics.h"
+
+#include <unordered_map>
+#include <algorithm>
+
+namespace
+{
+	// cell of the position and coarse color, packed into one key
+	uint64 lightKey(const Vec3 &position, const Vec3 &color, Real mergeDistance)
+	{
+		uint64 k = 0;
+		for (uint32 a = 0; a < 3; a++)
+			k = k * 1048573 + (uint64)(sint64)floor(position[a] / mergeDistance).value;
+		for (uint32 a = 0; a < 3; a++)
+			k = k * 8 + numeric_cast<uint32>(clamp(color[a], 0, 0.999).value * 8);
+		return k;
+	}
+}
+
+ParticlesPool::ParticlesPool(uint32 capacity)
+{
+	CAGE_ASSERT(capacity > 0);
+	positions.resize(capacity);
+	velocities.resize(capacity);
+	colors.resize(capacity);
+	ttls.resize(capacity);
+	alive.resize(capacity);
+	lights.resize(capacity);
+}
+
+uint32 ParticlesPool::emit(const Vec3 &position, const Vec3 &velocity, const Vec3 &color, uint32 ttl, bool light)
+{
+	const uint32 i = next;
+	next = (next + 1) % capacity();
+	if (alive[i])
+		overwritten++;
+	else
+		count++;
+	positions[i] = position;
+	velocities[i] = velocity;
+	colors[i] = color;
+	ttls[i] = ttl;
+	alive[i] = true;
+	lights[i] = light;
+	emitted++;
+	return i;
+}
+
+// same gravity and velocity damping as the physics
+void ParticlesPool::update(Real deltaTime)
+{
+	const Real damping = physicsDamping(deltaTime);
+	const Vec3 g = Vec3(0, -9.8, 0) * deltaTime;
+	const uint32 cap = capacity();
+	for (uint32 i = 0; i < cap; i++)
+	{
+		if (!alive[i])
+			continue;
+		if (ttls[i]-- == 0)
+		{
+			alive[i] = false;
+			count--;
+			continue;
+		}
+		Vec3 &v = velocities[i];
+		v = v * damping + g;
+		positions[i] += v * deltaTime;
+	}
+}
+
+uint32 ParticlesPool::selectLights(const Vec3 &focus, uint32 budget, Real mergeDistance, std::vector<ParticleLight> &result) const
+{
+	CAGE_ASSERT(mergeDistance > 0);
+	result.clear();
+	std::unordered_map<uint64, uint32> merged; // key -> index in the result
+	uint32 candidates = 0;
+	const uint32 cap = capacity();
+	for (uint32 i = 0; i < cap; i++)
+	{
+		if (!alive[i] || !lights[i])
+			continue;
+		candidates++;
+		const auto it = merged.emplace(lightKey(positions[i], colors[i], mergeDistance), numeric_cast<uint32>(result.size()));
+		if (it.second)
+			result.push_back({});
+		ParticleLight &l = result[it.first->second];
+		l.position += positions[i] * lightIntensity;
+		l.color += colors[i] * lightIntensity;
+		l.intensity += lightIntensity;
+		l.count++;
+	}
+	for (ParticleLight &l : result)
+	{
+		l.position /= l.intensity;
+		l.color /= l.intensity;
+		l.importance = l.intensity / (1 + lightAttenuation * distanceSquared(l.position, focus));
+	}
+	// the slot order breaks the ties, so that the selection is deterministic
+	std::stable_sort(result.begin(), result.end(), [](const ParticleLight &a, const ParticleLight &b) { return a.importance > b.importance; });
+	if (result.size() > budget)
+		result.resize(budget);
+	return candidates;
+}
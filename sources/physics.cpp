@@ -1,204 +1,369 @@
-#include "common.h"
+#include "physics.h"
 
 #include <cage-core/geometry.h>
 #include <cage-core/entities.h>
 #include <cage-core/collisionStructure.h>
 #include <cage-core/collider.h>
+#include <cage-core/config.h>
+#include <cage-core/concurrent.h>
+#include <cage-core/files.h>
 
 #include <cage-engine/scene.h>
 #include <cage-simple/engine.h>
 
-#include <vector>
-#include <unordered_map>
-#include <algorithm>
-
-SpringComponent::SpringComponent() : objects{0, 0}
-{}
-
-Real sphereVolume(Real radius)
-{
-	return 4 * Real::Pi() * pow(radius, 3) / 3;
-}
+#include <atomic>
+#include <unordered_set>
 
 namespace
 {
 	Holder<CollisionStructure> collisionSearchData = newCollisionStructure({});
-	Holder<CollisionQuery> collisionSearchQuery = newCollisionQuery(collisionSearchData.share());
 
-	class PhysicsSimulation
+	ConfigUint32 physicsThreads("cragsman/physics/threads", 0);
+	ConfigBool physicsXpbd("cragsman/physics/xpbd", false);
+	ConfigUint32 physicsIterations("cragsman/physics/iterations", 4);
+	ConfigUint32 physicsSleepUpdates("cragsman/physics/sleepUpdates", 30);
+
+	// fast bodies are swept against the terrain, which prevents tunneling of fast bodies
+	// the explicit springs are tuned for steps of the reference duration, a single step per update makes them stiffer and is only suitable with the xpbd solver
+	ConfigBool physicsContinuousCollisions("cragsman/physics/continuousCollisions", true);
+	ConfigUint32 physicsSteps("cragsman/physics/steps", 2);
+
+	ConfigBool physicsHeightfield("cragsman/physics/heightfield", true);
+
+	// updates per second of a dedicated physics thread, zero simulates in the control thread
+	// the dedicated thread always uses the heightfield, because the triangle colliders are not synchronized with it
+	ConfigUint32 physicsRate("cragsman/physics/rate", 0);
+
+	// path of a csv file with the statistics of every update, empty disables the log
+	ConfigString physicsProfileLog("cragsman/physics/profileLog", "");
+
+	// identifies the body in the asynchronous simulation and remembers the state last written to the entity
+	struct PhysicsAsyncComponent
 	{
-	public:
-		static constexpr uint32 repeatSteps = 2; // increasing steps increases simulation precision
-		const Real deltaTime = controlThread().updatePeriod() * 1e-6f / repeatSteps;
+		Vec3 position;
+		Vec3 velocity;
+		uint32 id = 0;
+	};
 
-		std::vector<Entity*> entsToDestroy;
-		std::unordered_map<Entity*, Vec3> acceleration;
+	struct PhysicsInput
+	{
+		PhysicsScene scene;
+		std::vector<bool> overrides; // bodies changed by the game since they were last written by the physics
+	};
 
-		static Vec3 entPos(Entity *e)
-		{
-			TransformComponent &t = e->value<TransformComponent>();
-			return t.position;
-		}
+	// shared between the control thread and the physics thread, guarded by the mutex
+	// the scenes are only swapped under the mutex, copies are made outside of it
+	struct PhysicsExchange
+	{
+		Holder<Mutex> mutex = newMutex();
+		PhysicsInput input;
+		bool inputReady = false;
+		std::vector<std::pair<uint32, Holder<const TerrainHeights>>> heightsChanges; // null removes the tile
+		PhysicsScene state; // latest state published by the physics thread
+		uint64 stateTime = 0; // time to which the state corresponds
+		bool stateReady = false;
+		PhysicsStatistics statistics;
+		std::atomic<bool> stopping = false;
+		uint64 period = 0;
 
-		static Real entMass(Entity *e)
-		{
-			if (e->has<PhysicsComponent>())
-			{
-				PhysicsComponent &p = e->value<PhysicsComponent>();
-				CAGE_ASSERT(p.mass > 1e-7);
-				return p.mass;
-			}
-			return Real::Infinity();
-		}
+		// owned by the control thread
+		PhysicsScene previous, current; // the two latest received states
+		uint64 previousTime = 0, currentTime = 0;
+		uint32 lastId = 0; // of the bodies in the asynchronous simulation
+	};
+
+	Holder<PhysicsSimulation> simulation;
+	PhysicsHeightfield heightfield; // of the control thread, used by the synchronous simulation and by the ray queries
+	PhysicsStatistics statistics;
+	Holder<PhysicsExchange> exchange;
+	Holder<Thread> physicsThread;
+	Holder<File> profileLog;
+
+	void configure(Real updateDuration)
+	{
+		simulation->repeatSteps = max((uint32)physicsSteps, 1u);
+		simulation->deltaTime = updateDuration / simulation->repeatSteps;
+		simulation->continuousCollisions = physicsContinuousCollisions;
+		simulation->solver = physicsXpbd ? PhysicsSolverEnum::Xpbd : PhysicsSolverEnum::Explicit;
+		simulation->iterations = max((uint32)physicsIterations, 1u);
+		simulation->sleepUpdates = physicsSleepUpdates;
+	}
 
-		static Vec3 entVel(Entity *e)
+	// bodies not changed by the game continue from the state of the physics thread, which is newer than the input
+	void mergeInput(PhysicsScene &state, PhysicsInput &input)
+	{
+		std::unordered_map<uint32, uint32> idToBody;
+		for (uint32 i = 0; i < state.bodies.dynamicCount + state.bodies.sleepingCount; i++)
+			idToBody[state.bodies.ids[i]] = i;
+		PhysicsBodies &b = input.scene.bodies;
+		for (uint32 i = 0; i < b.dynamicCount; i++)
 		{
-			if (e->has<PhysicsComponent>())
-			{
-				PhysicsComponent &p = e->value<PhysicsComponent>();
-				return p.velocity;
-			}
-			return {};
+			if (input.overrides[i])
+				continue;
+			const auto it = idToBody.find(b.ids[i]);
+			if (it == idToBody.end())
+				continue;
+			b.positions[i] = state.bodies.positions[it->second];
+			b.velocities[i] = state.bodies.velocities[it->second];
+			b.restingUpdates[i] = state.bodies.restingUpdates[it->second];
 		}
-
-		void addForce(Entity *e, const Vec3 &f)
+		// spring entities are only compared, never dereferenced
+		std::unordered_map<Entity *, Real> sleepLengths;
+		for (uint32 k = 0; k < state.springs.size(); k++)
+			sleepLengths[state.springEntities[k]] = state.springs[k].sleepLength;
+		for (uint32 k = 0; k < input.scene.springs.size(); k++)
 		{
-			CAGE_ASSERT(f.valid());
-			acceleration[e] += f / entMass(e);
+			const auto it = sleepLengths.find(input.scene.springEntities[k]);
+			if (it != sleepLengths.end())
+				input.scene.springs[k].sleepLength = it->second;
 		}
+		std::swap(state, input.scene);
+	}
 
-		void springs()
+	void physicsEntry()
+	{
+		PhysicsScene state;
+		PhysicsScene published; // buffer for the copy of the state, swapped with the exchange
+		PhysicsInput input;
+		PhysicsHeightfield threadHeightfield;
+		simulation->heightfield = &threadHeightfield;
+		const uint64 period = exchange->period;
+		uint64 next = applicationTime();
+		while (!exchange->stopping)
 		{
-			Real timeStep2 = deltaTime * deltaTime;
-			for (Entity *e : engineEntities()->component<SpringComponent>()->entities())
+			const uint64 now = applicationTime();
+			if (now < next)
 			{
-				SpringComponent &s = e->value<SpringComponent>();
-				CAGE_ASSERT(s.restDistance >= 0);
-				CAGE_ASSERT(s.stiffness > 0 && s.stiffness < 1);
-				CAGE_ASSERT(s.damping > 0 && s.damping < 1);
-				Entity *e1 = engineEntities()->get(s.objects[0]);
-				Entity *e2 = engineEntities()->get(s.objects[1]);
-				Vec3 p1 = entPos(e1);
-				Vec3 p2 = entPos(e2);
-				Real m1 = entMass(e1);
-				Real m2 = entMass(e2);
-				CAGE_ASSERT(m1.finite() || m2.finite());
-				Real m = (m1.finite() && m2.finite()) ? (m1 * m2) / (m1 + m2) : m1.finite() ? m1 : m2;
-				CAGE_ASSERT(m.valid() && m.finite());
-				Vec3 x = p2 - p1;
-				if (lengthSquared(x) > 1e-5)
-					x -= normalize(x) * s.restDistance;
-				else
-					x -= randomDirection3() * s.restDistance;
-				Vec3 v = entVel(e2) - entVel(e1);
-				Vec3 f = x * (s.stiffness * m / timeStep2) + v * (s.damping * m / deltaTime);
-				addForce(e1, f);
-				addForce(e2, -f);
+				threadSleep(next - now);
+				continue;
 			}
-		}
-
-		void gravity()
-		{
-			Vec3 g = Vec3(0, -9.8, 0);
-			for (Entity *e : engineEntities()->component<PhysicsComponent>()->entities())
+			if (now > next + period * 5)
+				next = now; // skip the steps instead of falling further behind
+			bool received = false;
 			{
-				PhysicsComponent &p = e->value<PhysicsComponent>();
-				addForce(e, p.mass * g);
+				ScopeLock<Mutex> lock(exchange->mutex);
+				if (exchange->inputReady)
+				{
+					std::swap(input, exchange->input);
+					exchange->inputReady = false;
+					received = true;
+				}
+				for (auto &it : exchange->heightsChanges)
+				{
+					if (it.second)
+						threadHeightfield.add(it.first, std::move(it.second));
+					else
+						threadHeightfield.remove(it.first);
+				}
+				exchange->heightsChanges.clear();
+			}
+			if (received)
+				mergeInput(state, input);
+			configure(period * 1e-6);
+			const uint64 start = applicationTime();
+			simulation->load(std::move(state));
+			simulation->run();
+			simulation->store(state);
+			PhysicsStatistics st = simulation->statistics;
+			st.updateTime = applicationTime() - start;
+			published = state;
+			{
+				ScopeLock<Mutex> lock(exchange->mutex);
+				std::swap(exchange->state, published);
+				exchange->stateTime = next;
+				exchange->stateReady = true;
+				exchange->statistics = st;
 			}
+			next += period;
 		}
+	}
 
-		Vec3 collisionResponse(const Transform &t, const PhysicsComponent &p, const Triangle &tr)
+	void sendInput(EntityManager *ents)
+	{
+		PhysicsInput input;
+		input.scene.gather(ents);
+		PhysicsBodies &b = input.scene.bodies;
+		input.overrides.resize(b.dynamicCount);
+		for (uint32 i = 0; i < b.dynamicCount; i++)
 		{
-			Vec3 n = tr.normal();
-			Vec3 bounce = -2 * n * dot(n, p.velocity);
-
-			Vec3 tp = closestPoint(tr, t.position);
-			Real penetration = -(distance(t.position, tp) - p.collisionRadius);
-			penetration = clamp(penetration, 0, 1);
-			Vec3 dir = normalize(t.position - tp);
-			Vec3 depenetration = dir * (pow(penetration + 1, 3) - 1);
-
-			return (bounce * 0.9 + depenetration * 2) * p.mass;
+			PhysicsAsyncComponent &a = b.entities[i]->value<PhysicsAsyncComponent>();
+			if (a.id == 0)
+			{
+				a.id = ++exchange->lastId;
+				input.overrides[i] = true;
+			}
+			else
+				input.overrides[i] = a.position != b.positions[i] || a.velocity != b.velocities[i];
+			a.position = b.positions[i];
+			a.velocity = b.velocities[i];
+			b.ids[i] = a.id;
+			b.entities[i]->value<PhysicsComponent>().wake = false; // carried by the input
 		}
-
-		void collisions()
+		ScopeLock<Mutex> lock(exchange->mutex);
+		if (exchange->inputReady)
 		{
-			for (Entity *e : engineEntities()->component<PhysicsComponent>()->entities())
+			// the previous input was not consumed yet, its overrides must not be lost
+			const PhysicsInput &old = exchange->input;
+			std::unordered_map<uint32, uint32> overridden;
+			std::unordered_set<uint32> woken;
+			for (uint32 i = 0; i < old.scene.bodies.dynamicCount; i++)
+			{
+				if (old.overrides[i])
+					overridden[old.scene.bodies.ids[i]] = i;
+				if (old.scene.bodies.wakes[i])
+					woken.insert(old.scene.bodies.ids[i]);
+			}
+			for (uint32 i = 0; i < b.dynamicCount; i++)
 			{
-				PhysicsComponent &p = e->value<PhysicsComponent>();
-				if (!p.collisionRadius.valid())
+				if (woken.count(b.ids[i]))
+					b.wakes[i] = true;
+				const auto it = overridden.find(b.ids[i]);
+				if (input.overrides[i] || it == overridden.end())
 					continue;
-				TransformComponent &t = e->value<TransformComponent>();
-				if (collisionSearchQuery->query(Sphere(t.position, p.collisionRadius)))
-				{
-					Holder<const Collider> c;
-					Transform dummy;
-					collisionSearchQuery->collider(c, dummy);
-					CAGE_ASSERT(dummy == Transform());
-					for (auto cp : collisionSearchQuery->collisionPairs())
-					{
-						const Triangle &tr = c->triangles()[cp.b];
-						addForce(e, collisionResponse(t, p, tr));
-					}
-				}
-				{ // ensure that the object is in front of the wall
-					// it is intended to correct objects that has fallen behind the wall before the wall was generated
-					// but it is not physical
-					Real to = terrainOffset(Vec2(t.position));
-					if (t.position[2] < to - p.collisionRadius * 0.5)
-						t.position[2] = to + p.collisionRadius;
-				}
+				b.positions[i] = old.scene.bodies.positions[it->second];
+				b.velocities[i] = old.scene.bodies.velocities[it->second];
+				b.restingUpdates[i] = old.scene.bodies.restingUpdates[it->second];
+				input.overrides[i] = true;
 			}
 		}
+		std::swap(exchange->input, input);
+		exchange->inputReady = true;
+	}
 
-		void applyAccelerations()
+	// the entities are interpolated between the two latest received states, delayed by one physics step
+	void receiveState(EntityManager *ents)
+	{
+		PhysicsScene &previous = exchange->previous;
+		PhysicsScene &current = exchange->current;
 		{
-			for (Entity *e : engineEntities()->component<PhysicsComponent>()->entities())
+			ScopeLock<Mutex> lock(exchange->mutex);
+			statistics = exchange->statistics;
+			if (exchange->stateReady)
 			{
-				CAGE_ASSERT(acceleration[e].valid());
-				PhysicsComponent &p = e->value<PhysicsComponent>();
-				CAGE_ASSERT(p.velocity.valid());
-				TransformComponent &t = e->value<TransformComponent>();
-				CAGE_ASSERT(t.position.valid());
-				p.velocity *= 0.995; // damping
-				p.velocity += acceleration[e] * deltaTime;
-				t.position += p.velocity * deltaTime;
+				// the oldest buffer is handed to the physics thread for its next copy
+				std::swap(previous, current);
+				std::swap(current, exchange->state);
+				exchange->previousTime = exchange->currentTime;
+				exchange->currentTime = exchange->stateTime;
+				exchange->stateReady = false;
 			}
 		}
-
-		void destroyEntities()
+		const uint64 previousTime = exchange->previousTime;
+		const uint64 currentTime = exchange->currentTime;
+		if (currentTime == 0)
+			return;
+		Real alpha = 1;
+		if (previousTime > 0 && currentTime > previousTime)
 		{
-			std::sort(entsToDestroy.begin(), entsToDestroy.end());
-			auto e = std::unique(entsToDestroy.begin(), entsToDestroy.end());
-			entsToDestroy.erase(e, entsToDestroy.end());
-			for (Entity *e : entsToDestroy)
-				e->destroy();
+			const uint64 now = applicationTime();
+			const uint64 shown = now > exchange->period ? now - exchange->period : 0;
+			alpha = clamp(Real(((double)shown - (double)previousTime) / (double)(currentTime - previousTime)), 0, 1);
 		}
-
-		void run()
+		std::unordered_map<uint32, Entity *> idToEntity;
+		for (Entity *e : ents->component<PhysicsAsyncComponent>()->entities())
 		{
-			for (uint32 step = 0; step < repeatSteps; step++)
-			{
-				springs();
-				gravity();
-				collisions();
-				applyAccelerations();
-				destroyEntities();
-			}
+			if (e->has<PhysicsComponent>())
+				idToEntity[e->value<PhysicsAsyncComponent>().id] = e;
 		}
-	};
+		std::unordered_map<uint32, uint32> idToPrevious;
+		for (uint32 i = 0; i < previous.bodies.dynamicCount + previous.bodies.sleepingCount; i++)
+			idToPrevious[previous.bodies.ids[i]] = i;
+		const PhysicsBodies &b = current.bodies;
+		for (uint32 i = 0; i < b.dynamicCount + b.sleepingCount; i++)
+		{
+			const auto it = idToEntity.find(b.ids[i]);
+			if (it == idToEntity.end())
+				continue; // destroyed by the game
+			Entity *e = it->second;
+			Vec3 position = b.positions[i];
+			const auto pt = idToPrevious.find(b.ids[i]);
+			if (pt != idToPrevious.end())
+				position = interpolate(previous.bodies.positions[pt->second], position, alpha);
+			e->value<TransformComponent>().position = position;
+			PhysicsComponent &p = e->value<PhysicsComponent>();
+			p.velocity = b.velocities[i];
+			p.restingUpdates = b.restingUpdates[i];
+			PhysicsAsyncComponent &a = e->value<PhysicsAsyncComponent>();
+			a.position = position;
+			a.velocity = p.velocity;
+		}
+	}
+
+	void writeProfile()
+	{
+		if (!profileLog)
+			return;
+		Stringizer line;
+		line + statistics.updateTime + "," + statistics.activeBodies + "," + statistics.sleepingBodies + "," + statistics.contactPairs + "," + statistics.terrainContacts + "," + statistics.wallCorrections;
+		for (uint64 t : statistics.phaseTimes)
+			line + "," + t;
+		profileLog->writeLine(line);
+	}
 
 	const auto engineUpdateListener = controlThread().update.listen([]() {
-		PhysicsSimulation simulation;
-		simulation.run();
+		if (replayHolding())
+			return;
+		if (exchange)
+		{
+			// changes made by the game are collected before they are overwritten by the physics state
+			sendInput(engineEntities());
+			receiveState(engineEntities());
+		}
+		else
+		{
+			configure(gameUpdatePeriod() * 1e-6);
+			simulation->heightfield = physicsHeightfield ? &heightfield : nullptr;
+			const uint64 start = applicationTime();
+			simulation->load(engineEntities());
+			simulation->run();
+			simulation->store();
+			statistics = simulation->statistics;
+			statistics.updateTime = applicationTime() - start;
+		}
+		writeProfile();
 	});
 
 	const auto engineInitListener = controlThread().initialize.listen([]() {
 		engineEntities()->defineComponent(PhysicsComponent());
 		engineEntities()->defineComponent(SpringComponent());
+		engineEntities()->defineComponent(PhysicsAsyncComponent());
+		simulation = systemMemory().createHolder<PhysicsSimulation>(collisionSearchData.share(), (uint32)physicsThreads);
+		if (physicsRate)
+		{
+			exchange = systemMemory().createHolder<PhysicsExchange>();
+			exchange->period = 1000000 / physicsRate;
+			physicsThread = newThread(Delegate<void()>().bind<&physicsEntry>(), "physics");
+		}
+		const String logPath = physicsProfileLog;
+		if (!logPath.empty())
+		{
+			profileLog = writeFile(logPath);
+			Stringizer header;
+			header + "updateTime,activeBodies,sleepingBodies,contactPairs,terrainContacts,wallCorrections";
+			for (const char *name : PhysicsPhaseNames)
+				header + "," + name + "Time";
+			profileLog->writeLine(header);
+		}
+	});
+
+	const auto engineFinalizeListener = controlThread().finalize.listen([]() {
+		if (physicsThread)
+		{
+			exchange->stopping = true;
+			physicsThread->wait();
+			physicsThread.clear();
+		}
+		exchange.clear();
+		simulation.clear();
+		profileLog.clear();
 	});
 }
 
+PhysicsStatistics physicsStatistics()
+{
+	return statistics;
+}
+
 void addTerrainCollider(uint32 name, Holder<Collider> c)
 {
 	collisionSearchData->update(name, std::move(c), Transform());
@@ -211,20 +376,27 @@ void removeTerrainCollider(uint32 name)
 	collisionSearchData->rebuild();
 }
 
-Vec3 terrainIntersection(const Line &ln)
+void addTerrainHeights(uint32 name, Holder<const TerrainHeights> heights)
 {
-	CAGE_ASSERT(ln.normalized());
-	if (!collisionSearchQuery->query(ln))
+	if (exchange)
 	{
-		// use old, less accurate method
-		Real dst = ln.a()[2] / dot(ln.direction, Vec3(0, 0, -1));
-		Vec3 base = ln.a() + ln.direction * dst;
-		CAGE_ASSERT(abs(base[2]) < 1e-5);
-		return Vec3(Vec2(base), terrainOffset(Vec2(base)));
+		ScopeLock<Mutex> lock(exchange->mutex);
+		exchange->heightsChanges.push_back({ name, heights.share() });
 	}
-	Holder<const Collider> c;
-	Transform dummy;
-	collisionSearchQuery->collider(c, dummy);
-	const Triangle &t = c->triangles()[collisionSearchQuery->collisionPairs()[0].b];
-	return intersection(ln, t);
+	heightfield.add(name, std::move(heights));
+}
+
+void removeTerrainHeights(uint32 name)
+{
+	if (exchange)
+	{
+		ScopeLock<Mutex> lock(exchange->mutex);
+		exchange->heightsChanges.push_back({ name, Holder<const TerrainHeights>() });
+	}
+	heightfield.remove(name);
+}
+
+Vec3 terrainIntersection(const Line &ln)
+{
+	return heightfield.intersection(ln);
 }
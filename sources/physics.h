@@ -0,0 +1,275 @@
+#ifndef cragsman_physics_h_k8j7h6g5f4
+#define cragsman_physics_h_k8j7h6g5f4
+
+#include "common.h"
+
+#include <cage-core/geometry.h>
+
+#include <vector>
+#include <unordered_map>
+
+namespace cage
+{
+	class EntityManager;
+	class CollisionStructure;
+	class CollisionQuery;
+	class ThreadPool;
+}
+
+constexpr Real PhysicsReferenceStep = 1.0 / 60; // default of PhysicsSimulation::referenceStep
+constexpr Real PhysicsVelocityDamping = 0.995; // fraction of the velocity kept over one reference step
+
+// velocity damping over the duration, shared with the simplified simulations of distant boulders and particles
+inline Real physicsDamping(Real duration, Real referenceStep = PhysicsReferenceStep)
+{
+	return pow(PhysicsVelocityDamping, duration / referenceStep);
+}
+
+// dense copy of the bodies taking part in the simulation, synchronized with the entities once per update
+// dynamic bodies come first, followed by sleeping bodies, and static spring endpoints, which have zero inverse mass
+struct PhysicsBodies
+{
+	std::vector<Entity *> entities;
+	std::vector<uint32> ids; // identifies the bodies across updates of the asynchronous simulation, zero otherwise
+	std::vector<Vec3> positions;
+	std::vector<Vec3> velocities;
+	std::vector<Vec3> accelerations;
+	std::vector<Real> invMasses;
+	std::vector<Real> radii; // nan for bodies that do not collide
+	std::vector<uint32> restingUpdates;
+	std::vector<bool> wakes; // the group of the body is woken in the next load
+	uint32 dynamicCount = 0;
+	uint32 sleepingCount = 0;
+
+	uint32 size() const
+	{
+		return numeric_cast<uint32>(entities.size());
+	}
+
+	void clear();
+	uint32 add(Entity *e, const Vec3 &position, const Vec3 &velocity, Real invMass, Real radius, uint32 restingUpdates = 0, bool wake = false);
+	void reorder(PointerRange<const uint32> order); // order[new index] = old index
+};
+
+// spatial hash of the dynamic bodies that collide, rebuilt every step
+// the cells are at least as large as the largest diameter, therefore only neighboring cells need to be searched
+struct PhysicsGrid
+{
+	Real cellSize;
+	std::vector<uint32> bucketsOffsets; // csr, sized buckets + 1
+	std::vector<uint32> items; // body indices, ascending in each bucket
+	std::vector<uint64> cells; // cell of each item, distinguishes cells sharing a bucket
+
+	void build(const PhysicsBodies &bodies);
+	uint32 pairsCount(const PhysicsBodies &bodies) const; // number of overlapping pairs
+
+	// calls the function with every body in the cell of the position or in the neighboring cells
+	template<class F>
+	void neighbors(const Vec3 &position, F &&f) const
+	{
+		if (items.empty())
+			return;
+		const sint32 x = coordinate(position[0]);
+		const sint32 y = coordinate(position[1]);
+		const sint32 z = coordinate(position[2]);
+		for (sint32 dz = -1; dz < 2; dz++)
+		{
+			for (sint32 dy = -1; dy < 2; dy++)
+			{
+				for (sint32 dx = -1; dx < 2; dx++)
+				{
+					const uint64 c = cell(x + dx, y + dy, z + dz);
+					const uint32 b = bucket(c);
+					for (uint32 k = bucketsOffsets[b]; k < bucketsOffsets[b + 1]; k++)
+					{
+						if (cells[k] == c)
+							f(items[k]);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	sint32 coordinate(Real v) const;
+	static uint64 cell(sint32 x, sint32 y, sint32 z);
+	uint32 bucket(uint64 cell) const;
+};
+
+// terrain height grids of the loaded tiles, looked up by the tile containing the position
+class PhysicsHeightfield
+{
+public:
+	void add(uint32 name, Holder<const TerrainHeights> heights);
+	void remove(uint32 name);
+	uint32 tilesCount() const;
+
+	// bilinear interpolation of the tile grid, falls back to the analytic terrain where no tile is loaded
+	Real sample(const Vec2 &position, Vec2 &gradient) const;
+
+	// exact intersection with the bilinear tile grids, found by descending the min-max pyramids, or with the analytic terrain where no tile is loaded
+	Vec3 intersection(const Line &ln) const;
+
+private:
+	std::unordered_map<uint64, Holder<const TerrainHeights>> tiles;
+	std::unordered_map<uint32, uint64> names;
+	Real tileLength;
+};
+
+// batched queries against the terrain colliders, each thread uses its own query context
+// the queries are processed in the order of a space filling curve, so that consecutive queries visit the same parts of the tree
+// results do not depend on the number of threads
+class TerrainQueries : private Immovable
+{
+public:
+	std::vector<uint32> offsets; // triangles touching sphere i are [offsets[i], offsets[i + 1])
+	std::vector<Triangle> triangles;
+	std::vector<Vec3> intersections; // first intersection of each ray, nan where the ray missed
+
+	// zero threads uses all cores, one thread runs the queries in the calling thread
+	TerrainQueries(Holder<CollisionStructure> terrain, uint32 threadsCount);
+	// uses the threads of the pool, which is rebound for each batch, null runs the queries in the calling thread
+	TerrainQueries(Holder<CollisionStructure> terrain, ThreadPool *threads);
+	~TerrainQueries();
+
+	void spheres(PointerRange<const Sphere> spheres);
+	void rays(PointerRange<const Line> rays);
+
+private:
+	Holder<CollisionStructure> terrain;
+	std::vector<Holder<CollisionQuery>> queries; // one per thread
+	Holder<ThreadPool> ownThreads;
+	ThreadPool *threads = nullptr;
+	PointerRange<const Sphere> currentSpheres;
+	PointerRange<const Line> currentRays;
+	bool spheresBatch = false;
+	std::vector<Vec3> positions; // of the queries
+	std::vector<uint32> order; // query indices sorted along the curve
+	std::vector<uint32> counts; // triangles touching each sphere
+	std::vector<std::vector<Triangle>> threadTriangles; // in the order of the queries processed by the thread
+
+	void initialize();
+	void sortQueries(PointerRange<const Vec3> positions);
+	void run();
+	static void threadEntry(TerrainQueries *q, uint32 thrIndex, uint32 thrCount);
+};
+
+struct PhysicsSpring
+{
+	uint32 bodies[2] = {};
+	Real restDistance;
+	Real stiffness;
+	Real damping;
+	Real sleepLength = Real::Nan();
+};
+
+// plain copy of the physics entities, which the simulation can run without access to the entities
+struct PhysicsScene
+{
+	PhysicsBodies bodies;
+	std::vector<PhysicsSpring> springs;
+	std::vector<Entity *> springEntities;
+
+	void clear();
+	void gather(EntityManager *ents);
+	void scatter() const; // writes the state of the dynamic and sleeping bodies and of the springs back to the entities
+};
+
+enum class PhysicsSolverEnum : uint32
+{
+	Explicit, // spring forces, integrated in repeatSteps steps per update
+	Xpbd, // position based spring constraints, one step per update
+};
+
+class PhysicsSimulation : private Immovable
+{
+public:
+	uint32 repeatSteps = 2; // increasing steps increases simulation precision
+	Real deltaTime; // duration of one explicit step, the update lasts deltaTime * repeatSteps
+	Real referenceStep = PhysicsReferenceStep; // stiffness and damping of springs and damping of velocities are relative to this step
+	PhysicsSolverEnum solver = PhysicsSolverEnum::Explicit;
+	uint32 iterations = 4; // constraint iterations of the xpbd solver
+	Real sleepVelocity = 0.05;
+	const PhysicsHeightfield *heightfield = nullptr; // terrain contacts from the heightfield, triangle colliders are used when null
+	uint32 sleepUpdates = 30; // a group of bodies connected with springs falls asleep after all of its bodies rested this many updates, zero disables sleeping
+	bool continuousCollisions = false; // bodies traveling farther than their radius in one step are swept along their path, so that they do not tunnel through the terrain
+
+	PhysicsBodies bodies;
+	std::vector<PhysicsSpring> springs; // springs of the dynamic bodies first, followed by springs of sleeping bodies
+	uint32 activeSprings = 0;
+
+	PhysicsStatistics statistics; // of the current update, reset by load, the update time is left to the caller
+
+	// zero threads uses all cores, one thread runs the simulation in the calling thread
+	// the terrain queries share the threads of the simulation
+	// results do not depend on the number of threads
+	PhysicsSimulation(Holder<CollisionStructure> terrain, uint32 threadsCount);
+	~PhysicsSimulation();
+
+	uint32 threadsCount() const;
+
+	void load(PhysicsScene &&scene);
+	void run();
+	void store(PhysicsScene &scene); // the simulation must be loaded again before next run
+
+	void load(EntityManager *ents);
+	void store();
+
+private:
+	enum class PhaseEnum : uint32
+	{
+		Springs,
+		Bodies,
+		Contacts,
+		Predict,
+		Constraints,
+		Corrections,
+	};
+
+	Holder<ThreadPool> threads; // before the terrain queries, which use it
+	TerrainQueries terrain;
+	std::vector<uint32> bodyTerrainQueries; // query of each dynamic body, m for bodies that do not collide with the terrain colliders
+	std::vector<Sphere> terrainSpheres;
+	PhaseEnum phase = PhaseEnum::Springs;
+	struct Counters
+	{
+		uint32 contacts = 0;
+		uint32 corrections = 0; // bodies moved in front of the terrain
+	};
+	std::vector<Counters> threadCounters; // found by each thread in the current phase
+
+	std::vector<uint32> bodyGroups; // bodies connected with springs do not collide with each other
+	std::vector<Vec3> contactAccelerations; // from collisions between bodies
+	std::vector<uint32> touchedGroups; // lowest sleeping group touched by each dynamic body, woken at the end of the update
+	std::vector<Entity *> springEntities;
+	PhysicsGrid grid;
+	std::vector<Vec3> springForces; // force (or xpbd position correction) of each spring, applied to its first body and negated for the second
+	std::vector<Real> springLambdas; // accumulated xpbd multipliers
+	std::vector<Vec3> previousPositions; // positions at the beginning of the xpbd step
+	std::vector<uint32> bodySpringsOffsets; // csr adjacency, sized bodies + 1
+	std::vector<uint32> bodySprings; // spring index * 2 + which end of the spring the body is
+
+	uint32 takeCounters(); // returns the contacts, the corrections are added to the statistics
+	void runPhase(PhaseEnum p);
+	void buildAdjacency();
+	void buildGroups();
+	void sleeping();
+
+	static void threadEntry(PhysicsSimulation *sim, uint32 thrIndex, uint32 thrCount);
+	void springsPhase(uint32 begin, uint32 end);
+	void bodiesPhase(uint32 begin, uint32 end, Counters &counters);
+	void contactsPhase(uint32 begin, uint32 end, Counters &counters);
+	void predictPhase(uint32 begin, uint32 end, Counters &counters);
+	void constraintsPhase(uint32 begin, uint32 end);
+	void correctionsPhase(uint32 begin, uint32 end);
+	Vec3 springsSum(uint32 i) const;
+	Vec3 collisions(uint32 i, Counters &counters);
+	Real terrainDistance(uint32 i, const Vec3 &position, Vec3 &normal) const;
+	void sweep(uint32 i, const Vec3 &from);
+	void runContacts();
+	void runTerrain();
+	void runExplicit();
+	void runXpbd();
+};
+
+#endif // !cragsman_physics_h_k8j7h6g5f4
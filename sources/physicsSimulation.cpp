@@ -0,0 +1,1405 @@
+#include "physics.h"
+
+#include <cage-core/geometry.h>
+#include <cage-core/entities.h>
+#include <cage-core/collisionStructure.h>
+#include <cage-core/collider.h>
+#include <cage-core/threadPool.h>
+
+#include <cage-engine/scene.h>
+
+#include <algorithm>
+#include <chrono>
+
+PhysicsComponent::PhysicsComponent() : restingUpdates(0), wake(false)
+{}
+
+SpringComponent::SpringComponent() : objects{0, 0}, sleepLength(Real::Nan())
+{}
+
+Real sphereVolume(Real radius)
+{
+	return 4 * Real::Pi() * pow(radius, 3) / 3;
+}
+
+void PhysicsBodies::clear()
+{
+	entities.clear();
+	ids.clear();
+	positions.clear();
+	velocities.clear();
+	accelerations.clear();
+	invMasses.clear();
+	radii.clear();
+	restingUpdates.clear();
+	wakes.clear();
+	dynamicCount = 0;
+	sleepingCount = 0;
+}
+
+uint32 PhysicsBodies::add(Entity *e, const Vec3 &position, const Vec3 &velocity, Real invMass, Real radius, uint32 resting, bool wake)
+{
+	entities.push_back(e);
+	ids.push_back(0);
+	positions.push_back(position);
+	velocities.push_back(velocity);
+	accelerations.push_back(Vec3());
+	invMasses.push_back(invMass);
+	radii.push_back(radius);
+	restingUpdates.push_back(resting);
+	wakes.push_back(wake);
+	return size() - 1;
+}
+
+namespace
+{
+	template<class T>
+	void reorderVector(std::vector<T> &v, PointerRange<const uint32> order)
+	{
+		std::vector<T> r;
+		r.reserve(order.size());
+		for (uint32 i : order)
+			r.push_back(v[i]);
+		std::swap(v, r);
+	}
+
+	uint32 rangeBegin(uint32 count, uint32 thrIndex, uint32 thrCount)
+	{
+		return numeric_cast<uint32>((uint64)count * thrIndex / thrCount);
+	}
+
+	// adds the duration of its scope to the time of the phase
+	struct PhaseTimer : private Immovable
+	{
+		uint64 &time;
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		PhaseTimer(PhysicsStatistics &statistics, PhysicsPhaseEnum phase) : time(statistics.phaseTimes[(uint32)phase]) {}
+
+		~PhaseTimer()
+		{
+			time += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+	};
+}
+
+void PhysicsBodies::reorder(PointerRange<const uint32> order)
+{
+	CAGE_ASSERT(order.size() == size());
+	reorderVector(entities, order);
+	reorderVector(ids, order);
+	reorderVector(positions, order);
+	reorderVector(velocities, order);
+	reorderVector(accelerations, order);
+	reorderVector(invMasses, order);
+	reorderVector(radii, order);
+	reorderVector(restingUpdates, order);
+	reorderVector(wakes, order);
+}
+
+void PhysicsScene::clear()
+{
+	bodies.clear();
+	springs.clear();
+	springEntities.clear();
+}
+
+void PhysicsScene::gather(EntityManager *ents)
+{
+	clear();
+	std::unordered_map<uint32, uint32> nameToBody;
+	for (Entity *e : ents->component<PhysicsComponent>()->entities())
+	{
+		const PhysicsComponent &p = e->value<PhysicsComponent>();
+		CAGE_ASSERT(p.mass > 1e-7);
+		CAGE_ASSERT(p.velocity.valid());
+		const Vec3 &position = e->value<TransformComponent>().position;
+		CAGE_ASSERT(position.valid());
+		const uint32 index = bodies.add(e, position, p.velocity, 1 / p.mass, p.collisionRadius, p.restingUpdates, p.wake);
+		if (e->name())
+			nameToBody[e->name()] = index;
+	}
+	bodies.dynamicCount = bodies.size();
+	const auto &bodyIndex = [&](uint32 name) -> uint32 {
+		auto it = nameToBody.find(name);
+		if (it != nameToBody.end())
+			return it->second;
+		// spring endpoint without physics is static
+		Entity *e = ents->get(name);
+		const uint32 index = bodies.add(e, e->value<TransformComponent>().position, Vec3(), 0, Real::Nan());
+		nameToBody[name] = index;
+		return index;
+	};
+	for (Entity *e : ents->component<SpringComponent>()->entities())
+	{
+		const SpringComponent &s = e->value<SpringComponent>();
+		CAGE_ASSERT(s.restDistance >= 0);
+		CAGE_ASSERT(s.stiffness > 0 && s.stiffness < 1);
+		CAGE_ASSERT(s.damping > 0 && s.damping < 1);
+		PhysicsSpring sp;
+		sp.bodies[0] = bodyIndex(s.objects[0]);
+		sp.bodies[1] = bodyIndex(s.objects[1]);
+		sp.restDistance = s.restDistance;
+		sp.stiffness = s.stiffness;
+		sp.damping = s.damping;
+		sp.sleepLength = s.sleepLength;
+		springs.push_back(sp);
+		springEntities.push_back(e);
+	}
+}
+
+void PhysicsScene::scatter() const
+{
+	for (uint32 i = 0; i < bodies.dynamicCount + bodies.sleepingCount; i++)
+	{
+		Entity *e = bodies.entities[i];
+		e->value<TransformComponent>().position = bodies.positions[i];
+		PhysicsComponent &p = e->value<PhysicsComponent>();
+		p.velocity = bodies.velocities[i];
+		p.restingUpdates = bodies.restingUpdates[i];
+		p.wake = false;
+	}
+	for (uint32 k = 0; k < springs.size(); k++)
+		springEntities[k]->value<SpringComponent>().sleepLength = springs[k].sleepLength;
+}
+
+sint32 PhysicsGrid::coordinate(Real v) const
+{
+	return numeric_cast<sint32>(floor(v / cellSize).value);
+}
+
+uint64 PhysicsGrid::cell(sint32 x, sint32 y, sint32 z)
+{
+	constexpr uint64 mask = (1 << 21) - 1;
+	constexpr sint32 bias = 1 << 20;
+	return ((uint64)(x + bias) & mask) | (((uint64)(y + bias) & mask) << 21) | (((uint64)(z + bias) & mask) << 42);
+}
+
+uint32 PhysicsGrid::bucket(uint64 cell) const
+{
+	const uint32 mask = numeric_cast<uint32>(bucketsOffsets.size() - 2); // buckets count is power of two
+	return hash(numeric_cast<uint32>(cell ^ (cell >> 32))) & mask;
+}
+
+void PhysicsGrid::build(const PhysicsBodies &bodies)
+{
+	bucketsOffsets.clear();
+	items.clear();
+	cells.clear();
+	const uint32 total = bodies.dynamicCount + bodies.sleepingCount;
+	Real largest = 0;
+	uint32 cnt = 0;
+	for (uint32 i = 0; i < total; i++)
+	{
+		if (bodies.radii[i].valid())
+		{
+			largest = max(largest, bodies.radii[i]);
+			cnt++;
+		}
+	}
+	if (cnt == 0)
+		return;
+	cellSize = max(largest * 2, 1e-3);
+	uint32 buckets = 1;
+	while (buckets < cnt * 2)
+		buckets *= 2;
+	bucketsOffsets.resize(buckets + 1, 0);
+	std::vector<uint64> bodyCells;
+	bodyCells.reserve(cnt);
+	for (uint32 i = 0; i < total; i++)
+	{
+		if (!bodies.radii[i].valid())
+			continue;
+		const Vec3 &p = bodies.positions[i];
+		const uint64 c = cell(coordinate(p[0]), coordinate(p[1]), coordinate(p[2]));
+		bodyCells.push_back(c);
+		bucketsOffsets[bucket(c) + 1]++;
+	}
+	for (uint32 b = 0; b < buckets; b++)
+		bucketsOffsets[b + 1] += bucketsOffsets[b];
+	items.resize(cnt);
+	cells.resize(cnt);
+	std::vector<uint32> fill(bucketsOffsets.begin(), bucketsOffsets.end() - 1);
+	uint32 k = 0;
+	for (uint32 i = 0; i < total; i++)
+	{
+		if (!bodies.radii[i].valid())
+			continue;
+		const uint64 c = bodyCells[k++];
+		const uint32 index = fill[bucket(c)]++;
+		items[index] = i;
+		cells[index] = c;
+	}
+}
+
+uint32 PhysicsGrid::pairsCount(const PhysicsBodies &bodies) const
+{
+	uint32 result = 0;
+	for (uint32 i : items)
+	{
+		neighbors(bodies.positions[i], [&](uint32 j) {
+			if (j > i && distance(bodies.positions[i], bodies.positions[j]) < bodies.radii[i] + bodies.radii[j])
+				result++;
+		});
+	}
+	return result;
+}
+
+namespace
+{
+	uint64 tileKey(sint32 x, sint32 y)
+	{
+		return ((uint64)(uint32)x << 32) | (uint32)y;
+	}
+
+	// number of blocks along one side of the level of the pyramid
+	uint32 levelWidth(uint32 cells, uint32 level)
+	{
+		return ((cells - 1) >> level) + 1;
+	}
+
+	// narrows the parameters of the ray to the part inside the rectangle, returns false when the ray misses it
+	bool clipRay(const Vec2 &origin, const Vec2 &direction, const Vec2 &lo, const Vec2 &hi, Real &ta, Real &tb)
+	{
+		for (uint32 a = 0; a < 2; a++)
+		{
+			if (abs(direction[a]) < 1e-12)
+			{
+				if (origin[a] < lo[a] || origin[a] > hi[a])
+					return false;
+				continue;
+			}
+			Real t1 = (lo[a] - origin[a]) / direction[a];
+			Real t2 = (hi[a] - origin[a]) / direction[a];
+			if (t1 > t2)
+				std::swap(t1, t2);
+			ta = max(ta, t1);
+			tb = min(tb, t2);
+		}
+		return ta <= tb;
+	}
+
+	// ray in the grid coordinates of one tile, the height is in world units
+	struct HeightsRay
+	{
+		const TerrainHeights &heights;
+		Vec2 origin, direction;
+		Real originHeight, directionHeight;
+
+		// the height of the bilinear cell along the ray is quadratic in the ray parameter, the first root within the range is the exact intersection
+		Real cell(uint32 ix, uint32 iy, Real ta, Real tb) const
+		{
+			const uint32 r = heights.resolution;
+			const Real *row = heights.heights.data() + iy * r + ix;
+			const Real h00 = row[0], h10 = row[1], h01 = row[r], h11 = row[r + 1];
+			const Real a1 = h10 - h00, a2 = h01 - h00, e = h00 - h10 - h01 + h11;
+			const Real px = origin[0] - ix, py = origin[1] - iy;
+			const Real dx = direction[0], dy = direction[1];
+			const Real a = -e * dx * dy;
+			const Real b = directionHeight - (a1 * dx + a2 * dy + e * (px * dy + py * dx));
+			const Real c = originHeight - (h00 + a1 * px + a2 * py + e * px * py);
+			Real roots[2] = { Real::Nan(), Real::Nan() };
+			if (abs(a) < 1e-7)
+			{
+				if (abs(b) > 1e-12)
+					roots[0] = -c / b;
+			}
+			else
+			{
+				const Real disc = b * b - 4 * a * c;
+				if (disc < 0)
+					return Real::Nan();
+				const Real q = -0.5 * (b + (b < 0 ? -sqrt(disc) : sqrt(disc)));
+				roots[0] = q / a;
+				if (abs(q) > 1e-12)
+					roots[1] = c / q;
+				if (roots[1] < roots[0])
+					std::swap(roots[0], roots[1]);
+			}
+			constexpr Real tolerance = 1e-4;
+			for (Real t : roots)
+			{
+				if (t.valid() && t >= ta - tolerance && t <= tb + tolerance)
+					return clamp(t, ta, tb);
+			}
+			return Real::Nan();
+		}
+
+		// blocks are visited front to back, the first hit is the closest one
+		Real block(uint32 level, uint32 bx, uint32 by, Real ta, Real tb) const
+		{
+			const uint32 cells = heights.resolution - 1;
+			const Vec2 lo = Vec2(bx << level, by << level);
+			const Vec2 hi = Vec2(min((bx + 1) << level, cells), min((by + 1) << level, cells));
+			if (!clipRay(origin, direction, lo, hi, ta, tb))
+				return Real::Nan();
+			const Vec2 range = heights.pyramid[level][by * levelWidth(cells, level) + bx];
+			const Real z1 = originHeight + directionHeight * ta;
+			const Real z2 = originHeight + directionHeight * tb;
+			if (max(z1, z2) < range[0] || min(z1, z2) > range[1])
+				return Real::Nan();
+			if (level == 0)
+				return cell(bx, by, ta, tb);
+			const uint32 w = levelWidth(cells, level - 1);
+			struct Child
+			{
+				Real entry;
+				uint32 x, y;
+			} children[4];
+			uint32 cnt = 0;
+			for (uint32 cy = by * 2; cy < min(by * 2 + 2, w); cy++)
+			{
+				for (uint32 cx = bx * 2; cx < min(bx * 2 + 2, w); cx++)
+				{
+					Real ca = ta, cb = tb;
+					const Vec2 clo = Vec2(cx << (level - 1), cy << (level - 1));
+					const Vec2 chi = Vec2(min((cx + 1) << (level - 1), cells), min((cy + 1) << (level - 1), cells));
+					if (clipRay(origin, direction, clo, chi, ca, cb))
+						children[cnt++] = { ca, cx, cy };
+				}
+			}
+			for (uint32 i = 1; i < cnt; i++)
+			{
+				for (uint32 j = i; j > 0 && children[j].entry < children[j - 1].entry; j--)
+					std::swap(children[j], children[j - 1]);
+			}
+			for (uint32 i = 0; i < cnt; i++)
+			{
+				const Real t = block(level - 1, children[i].x, children[i].y, ta, tb);
+				if (t.valid())
+					return t;
+			}
+			return Real::Nan();
+		}
+	};
+}
+
+void TerrainHeights::buildPyramid()
+{
+	CAGE_ASSERT(resolution >= 2 && heights.size() == resolution * resolution);
+	const uint32 cells = resolution - 1;
+	pyramid.clear();
+	{
+		std::vector<Vec2> level;
+		level.reserve(cells * cells);
+		for (uint32 y = 0; y < cells; y++)
+		{
+			for (uint32 x = 0; x < cells; x++)
+			{
+				const Real *row = heights.data() + y * resolution + x;
+				const Real a = min(min(row[0], row[1]), min(row[resolution], row[resolution + 1]));
+				const Real b = max(max(row[0], row[1]), max(row[resolution], row[resolution + 1]));
+				level.push_back(Vec2(a, b));
+			}
+		}
+		pyramid.push_back(std::move(level));
+	}
+	for (uint32 l = 1; levelWidth(cells, l - 1) > 1; l++)
+	{
+		const uint32 pw = levelWidth(cells, l - 1);
+		const uint32 w = levelWidth(cells, l);
+		const std::vector<Vec2> &prev = pyramid[l - 1];
+		std::vector<Vec2> level(w * w, Vec2(Real::Infinity(), -Real::Infinity()));
+		for (uint32 y = 0; y < pw; y++)
+		{
+			for (uint32 x = 0; x < pw; x++)
+			{
+				Vec2 &r = level[(y / 2) * w + x / 2];
+				const Vec2 p = prev[y * pw + x];
+				r = Vec2(min(r[0], p[0]), max(r[1], p[1]));
+			}
+		}
+		pyramid.push_back(std::move(level));
+	}
+}
+
+void PhysicsHeightfield::add(uint32 name, Holder<const TerrainHeights> heights)
+{
+	CAGE_ASSERT(heights->resolution >= 2 && heights->heights.size() == heights->resolution * heights->resolution);
+	CAGE_ASSERT(!heights->pyramid.empty());
+	CAGE_ASSERT(tiles.empty() || tileLength == heights->tileLength);
+	tileLength = heights->tileLength;
+	const uint64 key = tileKey(heights->tileX, heights->tileY);
+	names[name] = key;
+	tiles[key] = std::move(heights);
+}
+
+void PhysicsHeightfield::remove(uint32 name)
+{
+	auto it = names.find(name);
+	if (it == names.end())
+		return;
+	tiles.erase(it->second);
+	names.erase(it);
+}
+
+uint32 PhysicsHeightfield::tilesCount() const
+{
+	return numeric_cast<uint32>(tiles.size());
+}
+
+Real PhysicsHeightfield::sample(const Vec2 &position, Vec2 &gradient) const
+{
+	if (!tiles.empty())
+	{
+		const sint32 tx = numeric_cast<sint32>(floor(position[0] / tileLength).value);
+		const sint32 ty = numeric_cast<sint32>(floor(position[1] / tileLength).value);
+		const auto it = tiles.find(tileKey(tx, ty));
+		if (it != tiles.end())
+		{
+			const TerrainHeights &t = *it->second;
+			const Vec2 local = (position - t.origin) / t.spacing;
+			const sint32 ix = numeric_cast<sint32>(floor(local[0]).value);
+			const sint32 iy = numeric_cast<sint32>(floor(local[1]).value);
+			const sint32 r = t.resolution;
+			if (ix >= 0 && iy >= 0 && ix + 1 < r && iy + 1 < r)
+			{
+				const Real fx = local[0] - ix;
+				const Real fy = local[1] - iy;
+				const Real *row = t.heights.data() + iy * r + ix;
+				const Real h00 = row[0], h10 = row[1], h01 = row[r], h11 = row[r + 1];
+				const Real hx0 = h00 + (h10 - h00) * fx;
+				const Real hx1 = h01 + (h11 - h01) * fx;
+				gradient[0] = ((h10 - h00) * (1 - fy) + (h11 - h01) * fy) / t.spacing;
+				gradient[1] = (hx1 - hx0) / t.spacing;
+				return hx0 + (hx1 - hx0) * fy;
+			}
+		}
+	}
+	return terrainOffset(position, gradient);
+}
+
+Vec3 PhysicsHeightfield::intersection(const Line &ln) const
+{
+	CAGE_ASSERT(ln.normalized());
+	const Vec3 a = ln.a();
+	const Vec3 dir = ln.direction;
+	if (!tiles.empty() && abs(dir[2]) > 1e-5)
+	{
+		// only the part of the ray within the heights of the loaded tiles is walked
+		Real lo = Real::Infinity(), hi = -Real::Infinity();
+		for (const auto &it : tiles)
+		{
+			const Vec2 r = it.second->pyramid.back()[0];
+			lo = min(lo, r[0]);
+			hi = max(hi, r[1]);
+		}
+		Real t1 = (lo - a[2]) / dir[2];
+		Real t2 = (hi - a[2]) / dir[2];
+		if (t1 > t2)
+			std::swap(t1, t2);
+		t1 = max(t1, 0);
+		t2 = min(t2, ln.maximum - ln.minimum);
+
+		// walks the tiles crossed by the ray in order
+		Real t = t1;
+		const Vec2 start = Vec2(a + dir * t);
+		sint32 tx = numeric_cast<sint32>(floor(start[0] / tileLength).value);
+		sint32 ty = numeric_cast<sint32>(floor(start[1] / tileLength).value);
+		const sint32 sx = dir[0] > 0 ? 1 : -1;
+		const sint32 sy = dir[1] > 0 ? 1 : -1;
+		const Real nextX = abs(dir[0]) > 1e-12 ? ((tx + (sx > 0)) * tileLength - a[0]) / dir[0] : Real::Infinity();
+		const Real nextY = abs(dir[1]) > 1e-12 ? ((ty + (sy > 0)) * tileLength - a[1]) / dir[1] : Real::Infinity();
+		const Real deltaX = abs(dir[0]) > 1e-12 ? tileLength / abs(dir[0]) : Real::Infinity();
+		const Real deltaY = abs(dir[1]) > 1e-12 ? tileLength / abs(dir[1]) : Real::Infinity();
+		Real tMaxX = nextX, tMaxY = nextY;
+		while (t <= t2)
+		{
+			const Real end = min(min(tMaxX, tMaxY), t2);
+			const auto it = tiles.find(tileKey(tx, ty));
+			if (it != tiles.end())
+			{
+				const TerrainHeights &h = *it->second;
+				const HeightsRay ray = { h, (Vec2(a) - h.origin) / h.spacing, Vec2(dir) / h.spacing, a[2], dir[2] };
+				const uint32 top = numeric_cast<uint32>(h.pyramid.size() - 1);
+				const Real hit = ray.block(top, 0, 0, t, end);
+				if (hit.valid())
+					return a + dir * hit;
+			}
+			if (end >= t2)
+				break;
+			t = end;
+			if (tMaxX < tMaxY)
+			{
+				tx += sx;
+				tMaxX += deltaX;
+			}
+			else
+			{
+				ty += sy;
+				tMaxY += deltaY;
+			}
+		}
+	}
+
+	// newton iterations on the analytic terrain, starting at the plane of zero height, cover the tiles that are not loaded yet
+	// steps that do not bring the ray closer to the surface are halved
+	CAGE_ASSERT(abs(dir[2]) > 1e-5);
+	const auto &residual = [&](Real t, Real &derivative) {
+		const Vec3 p = a + dir * t;
+		Vec2 g;
+		const Real f = p[2] - terrainOffset(Vec2(p), g);
+		derivative = dir[2] - dot(g, Vec2(dir));
+		return f;
+	};
+	Real t = -a[2] / dir[2];
+	Real df;
+	Real f = residual(t, df);
+	for (uint32 i = 0; i < 20 && abs(f) > 1e-4 && abs(df) > 1e-5; i++)
+	{
+		Real step = f / df;
+		Real nf, ndf;
+		for (uint32 j = 0; j < 10; j++, step *= 0.5)
+		{
+			nf = residual(t - step, ndf);
+			if (abs(nf) < abs(f))
+				break;
+		}
+		t -= step;
+		f = nf;
+		df = ndf;
+	}
+	const Vec2 base = Vec2(a + dir * t);
+	return Vec3(base, terrainOffset(base));
+}
+
+namespace
+{
+	// interleaves the lowest 10 bits with zeros
+	uint32 spreadBits(uint32 v)
+	{
+		v &= 0x3ff;
+		v = (v | (v << 16)) & 0x030000ff;
+		v = (v | (v << 8)) & 0x0300f00f;
+		v = (v | (v << 4)) & 0x030c30c3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+}
+
+TerrainQueries::TerrainQueries(Holder<CollisionStructure> terrain_, uint32 threadsCount) : terrain(std::move(terrain_))
+{
+	if (threadsCount != 1)
+	{
+		ownThreads = newThreadPool("terrain_", threadsCount ? threadsCount : m);
+		threads = +ownThreads;
+	}
+	initialize();
+}
+
+TerrainQueries::TerrainQueries(Holder<CollisionStructure> terrain_, ThreadPool *threads) : terrain(std::move(terrain_)), threads(threads)
+{
+	initialize();
+}
+
+TerrainQueries::~TerrainQueries()
+{}
+
+void TerrainQueries::initialize()
+{
+	const uint32 cnt = threads ? threads->threadsCount() : 1;
+	for (uint32 i = 0; i < cnt; i++)
+		queries.push_back(newCollisionQuery(terrain.share()));
+	threadTriangles.resize(cnt);
+}
+
+// z-order of the positions quantized within their bounding box, ties are ordered by the index
+void TerrainQueries::sortQueries(PointerRange<const Vec3> positions)
+{
+	const uint32 cnt = numeric_cast<uint32>(positions.size());
+	order.resize(cnt);
+	if (cnt == 0)
+		return;
+	Vec3 a = positions[0], b = positions[0];
+	for (const Vec3 &p : positions)
+	{
+		a = min(a, p);
+		b = max(b, p);
+	}
+	const Vec3 scale = 1023 / max(b - a, Vec3(1e-5));
+	std::vector<uint64> keys;
+	keys.reserve(cnt);
+	for (uint32 i = 0; i < cnt; i++)
+	{
+		const Vec3 q = (positions[i] - a) * scale;
+		const uint32 code = spreadBits(numeric_cast<uint32>(q[0].value)) | (spreadBits(numeric_cast<uint32>(q[1].value)) << 1) | (spreadBits(numeric_cast<uint32>(q[2].value)) << 2);
+		keys.push_back(((uint64)code << 32) | i);
+	}
+	std::sort(keys.begin(), keys.end());
+	for (uint32 k = 0; k < cnt; k++)
+		order[k] = (uint32)keys[k];
+}
+
+void TerrainQueries::run()
+{
+	sortQueries(positions);
+	if (threads)
+	{
+		threads->function.bind<TerrainQueries *, &TerrainQueries::threadEntry>(this);
+		threads->run();
+	}
+	else
+		threadEntry(this, 0, 1);
+}
+
+void TerrainQueries::threadEntry(TerrainQueries *q, uint32 thrIndex, uint32 thrCount)
+{
+	const uint32 cnt = numeric_cast<uint32>(q->order.size());
+	const uint32 begin = rangeBegin(cnt, thrIndex, thrCount);
+	const uint32 end = rangeBegin(cnt, thrIndex + 1, thrCount);
+	CollisionQuery *query = +q->queries[thrIndex];
+	if (q->spheresBatch)
+	{
+		std::vector<Triangle> &tris = q->threadTriangles[thrIndex];
+		tris.clear();
+		for (uint32 k = begin; k < end; k++)
+		{
+			const uint32 i = q->order[k];
+			q->counts[i] = 0;
+			if (!query->query(q->currentSpheres[i]))
+				continue;
+			Holder<const Collider> c;
+			Transform dummy;
+			query->collider(c, dummy);
+			CAGE_ASSERT(dummy == Transform());
+			for (auto cp : query->collisionPairs())
+				tris.push_back(c->triangles()[cp.b]);
+			q->counts[i] = numeric_cast<uint32>(query->collisionPairs().size());
+		}
+	}
+	else
+	{
+		for (uint32 k = begin; k < end; k++)
+		{
+			const uint32 i = q->order[k];
+			const Line &ln = q->currentRays[i];
+			q->intersections[i] = Vec3::Nan();
+			if (!query->query(ln))
+				continue;
+			Holder<const Collider> c;
+			Transform dummy;
+			query->collider(c, dummy);
+			const Triangle &t = c->triangles()[query->collisionPairs()[0].b];
+			q->intersections[i] = intersection(ln, t);
+		}
+	}
+}
+
+void TerrainQueries::spheres(PointerRange<const Sphere> spheres)
+{
+	const uint32 cnt = numeric_cast<uint32>(spheres.size());
+	currentSpheres = spheres;
+	spheresBatch = true;
+	positions.clear();
+	for (const Sphere &s : spheres)
+		positions.push_back(s.center);
+	counts.resize(cnt);
+	run();
+	offsets.resize(cnt + 1);
+	offsets[0] = 0;
+	for (uint32 i = 0; i < cnt; i++)
+		offsets[i + 1] = offsets[i] + counts[i];
+	triangles.resize(offsets[cnt]);
+	// the contacts are stored in the order of the spheres
+	const uint32 thrCount = numeric_cast<uint32>(queries.size());
+	for (uint32 t = 0; t < thrCount; t++)
+	{
+		const Triangle *src = threadTriangles[t].data();
+		for (uint32 k = rangeBegin(cnt, t, thrCount); k < rangeBegin(cnt, t + 1, thrCount); k++)
+		{
+			const uint32 i = order[k];
+			std::copy(src, src + counts[i], triangles.begin() + offsets[i]);
+			src += counts[i];
+		}
+	}
+	currentSpheres = {};
+}
+
+void TerrainQueries::rays(PointerRange<const Line> rays)
+{
+	currentRays = rays;
+	spheresBatch = false;
+	positions.clear();
+	for (const Line &ln : rays)
+		positions.push_back(ln.origin);
+	intersections.resize(rays.size());
+	run();
+	currentRays = {};
+}
+
+namespace
+{
+	// acceleration pushing the body out of the surface with the normal n, in the direction dir
+	Vec3 surfaceResponse(const Vec3 &velocity, const Vec3 &n, const Vec3 &dir, Real penetration)
+	{
+		Vec3 bounce = -2 * n * dot(n, velocity);
+		penetration = clamp(penetration, 0, 1);
+		Vec3 depenetration = dir * (pow(penetration + 1, 3) - 1);
+		return bounce * 0.9 + depenetration * 2;
+	}
+
+	// acceleration pushing the body out of the triangle
+	Vec3 collisionResponse(const Vec3 &position, const Vec3 &velocity, Real radius, const Triangle &tr)
+	{
+		Vec3 tp = closestPoint(tr, position);
+		return surfaceResponse(velocity, tr.normal(), normalize(position - tp), radius - distance(position, tp));
+	}
+
+	// acceleration pushing the first sphere away from the second, responses of both spheres have opposite momentum
+	// zero inverse mass of the second sphere makes it immovable
+	Vec3 contactResponse(const Vec3 &p1, const Vec3 &v1, Real r1, Real im1, const Vec3 &p2, const Vec3 &v2, Real r2, Real im2, const Vec3 &fallback)
+	{
+		const Vec3 d = p1 - p2;
+		const Real dist = length(d);
+		const Real penetration = r1 + r2 - dist;
+		if (penetration <= 0)
+			return {};
+		const Vec3 n = dist > 1e-5 ? d / dist : fallback;
+		const Real share = im2 > 0 ? 2 * im1 / (im1 + im2) : Real(1); // two equal spheres, or a sphere and an immovable one, respond like a sphere against the terrain
+		const Real approach = dot(n, v1 - v2);
+		const Vec3 bounce = approach < 0 ? -2 * n * approach : Vec3();
+		const Vec3 depenetration = n * (pow(min(penetration, 1) + 1, 3) - 1);
+		return (bounce * 0.9 + depenetration * 2) * share;
+	}
+}
+
+PhysicsSimulation::PhysicsSimulation(Holder<CollisionStructure> terrain_, uint32 threadsCount) : threads(threadsCount == 1 ? Holder<ThreadPool>() : newThreadPool("physics_", threadsCount ? threadsCount : m)), terrain(std::move(terrain_), +threads)
+{
+	threadCounters.resize(this->threadsCount());
+}
+
+PhysicsSimulation::~PhysicsSimulation()
+{}
+
+uint32 PhysicsSimulation::threadsCount() const
+{
+	return threads ? threads->threadsCount() : 1;
+}
+
+// the pool is rebound for every phase, because the terrain queries use it too
+void PhysicsSimulation::runPhase(PhaseEnum p)
+{
+	phase = p;
+	if (threads)
+	{
+		threads->function.bind<PhysicsSimulation *, &PhysicsSimulation::threadEntry>(this);
+		threads->run();
+	}
+	else
+		threadEntry(this, 0, 1);
+}
+
+uint32 PhysicsSimulation::takeCounters()
+{
+	uint32 sum = 0;
+	for (Counters &c : threadCounters)
+	{
+		sum += c.contacts;
+		statistics.wallCorrections += c.corrections;
+		c = {};
+	}
+	return sum;
+}
+
+void PhysicsSimulation::buildAdjacency()
+{
+	const uint32 cnt = bodies.size();
+	bodySpringsOffsets.clear();
+	bodySpringsOffsets.resize(cnt + 1, 0);
+	for (uint32 s = 0; s < activeSprings; s++)
+	{
+		bodySpringsOffsets[springs[s].bodies[0] + 1]++;
+		bodySpringsOffsets[springs[s].bodies[1] + 1]++;
+	}
+	for (uint32 i = 0; i < cnt; i++)
+		bodySpringsOffsets[i + 1] += bodySpringsOffsets[i];
+	bodySprings.resize(activeSprings * 2);
+	std::vector<uint32> fill(bodySpringsOffsets.begin(), bodySpringsOffsets.end() - 1);
+	// springs are visited in increasing order, which keeps the summation order fixed
+	for (uint32 s = 0; s < activeSprings; s++)
+	{
+		bodySprings[fill[springs[s].bodies[0]]++] = s * 2 + 0;
+		bodySprings[fill[springs[s].bodies[1]]++] = s * 2 + 1;
+	}
+}
+
+// union-find over the springs, every group is represented by its lowest body
+void PhysicsSimulation::buildGroups()
+{
+	const uint32 cnt = bodies.size();
+	bodyGroups.resize(cnt);
+	for (uint32 i = 0; i < cnt; i++)
+		bodyGroups[i] = i;
+	const auto &find = [&](uint32 i) {
+		while (bodyGroups[i] != i)
+			i = bodyGroups[i] = bodyGroups[bodyGroups[i]];
+		return i;
+	};
+	for (const PhysicsSpring &s : springs)
+	{
+		const uint32 a = find(s.bodies[0]);
+		const uint32 b = find(s.bodies[1]);
+		if (a < b)
+			bodyGroups[b] = a;
+		else
+			bodyGroups[a] = b;
+	}
+	for (uint32 i = 0; i < cnt; i++)
+		bodyGroups[i] = find(i);
+}
+
+// decides which groups of bodies sleep and moves the sleeping bodies and their springs behind the dynamic ones
+// the sleeping state is kept in the scene between updates
+void PhysicsSimulation::sleeping()
+{
+	const uint32 cnt = bodies.size();
+	const uint32 dyn = bodies.dynamicCount;
+	std::vector<bool> disturbed(cnt, false);
+	for (uint32 i = 0; i < dyn; i++)
+	{
+		if (bodies.wakes[i])
+		{
+			disturbed[bodyGroups[i]] = true; // requested by the game, e.g. a removed spring
+			bodies.wakes[i] = false;
+		}
+	}
+	if (sleepUpdates == 0)
+		return;
+	const uint32 n = sleepUpdates;
+	std::vector<uint32> minResting(cnt, (uint32)m), maxResting(cnt, 0);
+	for (uint32 i = 0; i < dyn; i++)
+	{
+		const uint32 resting = bodies.restingUpdates[i];
+		const uint32 g = bodyGroups[i];
+		minResting[g] = min(minResting[g], resting);
+		maxResting[g] = max(maxResting[g], resting);
+		if (resting > n && lengthSquared(bodies.velocities[i]) > 0)
+			disturbed[g] = true; // external force
+	}
+	for (uint32 k = 0; k < springs.size(); k++)
+	{
+		const PhysicsSpring &s = springs[k];
+		const uint32 g = bodyGroups[s.bodies[0]];
+		const Real len = distance(bodies.positions[s.bodies[0]], bodies.positions[s.bodies[1]]);
+		if (maxResting[g] > n && !(abs(len - s.sleepLength) < 1e-3))
+			disturbed[g] = true; // new spring or moved static endpoint
+	}
+
+	std::vector<uint32> order;
+	order.reserve(cnt);
+	std::vector<uint32> asleep;
+	for (uint32 i = 0; i < dyn; i++)
+	{
+		const uint32 g = bodyGroups[i];
+		uint32 &resting = bodies.restingUpdates[i];
+		if (minResting[g] >= n && !disturbed[g])
+		{
+			resting = n + 1;
+			bodies.velocities[i] = Vec3();
+			asleep.push_back(i);
+		}
+		else
+		{
+			if (resting > n)
+				resting = 0; // woken
+			order.push_back(i);
+		}
+	}
+	if (asleep.empty())
+		return;
+	bodies.dynamicCount = numeric_cast<uint32>(order.size());
+	bodies.sleepingCount = numeric_cast<uint32>(asleep.size());
+	order.insert(order.end(), asleep.begin(), asleep.end());
+	for (uint32 i = dyn; i < cnt; i++)
+		order.push_back(i);
+	bodies.reorder(order);
+	reorderVector(bodyGroups, order); // groups keep their original representatives, they are only compared
+	std::vector<uint32> remap(cnt);
+	for (uint32 i = 0; i < cnt; i++)
+		remap[order[i]] = i;
+
+	// springs of sleeping groups remember their length and are excluded from the simulation
+	std::vector<uint32> springsOrder;
+	springsOrder.reserve(springs.size());
+	std::vector<uint32> sleepingSprings;
+	for (uint32 k = 0; k < springs.size(); k++)
+	{
+		PhysicsSpring &s = springs[k];
+		s.bodies[0] = remap[s.bodies[0]];
+		s.bodies[1] = remap[s.bodies[1]];
+		if (min(s.bodies[0], s.bodies[1]) >= bodies.dynamicCount)
+		{
+			s.sleepLength = distance(bodies.positions[s.bodies[0]], bodies.positions[s.bodies[1]]);
+			sleepingSprings.push_back(k);
+		}
+		else
+			springsOrder.push_back(k);
+	}
+	activeSprings = numeric_cast<uint32>(springsOrder.size());
+	springsOrder.insert(springsOrder.end(), sleepingSprings.begin(), sleepingSprings.end());
+	reorderVector(springs, springsOrder);
+	reorderVector(springEntities, springsOrder);
+}
+
+void PhysicsSimulation::load(PhysicsScene &&scene)
+{
+	statistics = {};
+	PhaseTimer timer(statistics, PhysicsPhaseEnum::Load);
+	bodies = std::move(scene.bodies);
+	springs = std::move(scene.springs);
+	springEntities = std::move(scene.springEntities);
+	scene.clear();
+	CAGE_ASSERT(springEntities.size() == springs.size());
+	// sleeping bodies from the previous update are decided again
+	bodies.dynamicCount += bodies.sleepingCount;
+	bodies.sleepingCount = 0;
+	std::fill(bodies.accelerations.begin(), bodies.accelerations.end(), Vec3());
+	activeSprings = numeric_cast<uint32>(springs.size());
+	buildGroups();
+	sleeping();
+	springForces.resize(activeSprings);
+	springLambdas.resize(activeSprings);
+	previousPositions.resize(bodies.dynamicCount);
+	contactAccelerations.clear();
+	contactAccelerations.resize(bodies.dynamicCount);
+	touchedGroups.clear();
+	touchedGroups.resize(bodies.dynamicCount, (uint32)m);
+	buildAdjacency();
+	statistics.activeBodies = bodies.dynamicCount;
+	statistics.sleepingBodies = bodies.sleepingCount;
+}
+
+void PhysicsSimulation::store(PhysicsScene &scene)
+{
+	PhaseTimer timer(statistics, PhysicsPhaseEnum::Store);
+	const Real sleepVelocity2 = sleepVelocity * sleepVelocity;
+	std::vector<bool> woken;
+	for (uint32 i = 0; i < bodies.dynamicCount; i++)
+	{
+		uint32 &resting = bodies.restingUpdates[i];
+		if (sleepUpdates && lengthSquared(bodies.velocities[i]) < sleepVelocity2)
+			resting = min(resting + 1, sleepUpdates);
+		else
+			resting = 0;
+		if (touchedGroups[i] != (uint32)m)
+		{
+			woken.resize(bodies.size(), false);
+			woken[touchedGroups[i]] = true;
+		}
+	}
+	if (!woken.empty())
+	{
+		for (uint32 i = bodies.dynamicCount; i < bodies.dynamicCount + bodies.sleepingCount; i++)
+		{
+			if (woken[bodyGroups[i]])
+				bodies.restingUpdates[i] = 0;
+		}
+	}
+	scene.bodies = std::move(bodies);
+	scene.springs = std::move(springs);
+	scene.springEntities = std::move(springEntities);
+	bodies.clear();
+	springs.clear();
+	springEntities.clear();
+	activeSprings = 0;
+}
+
+void PhysicsSimulation::load(EntityManager *ents)
+{
+	PhysicsStatistics gathering;
+	PhysicsScene scene;
+	{
+		PhaseTimer timer(gathering, PhysicsPhaseEnum::Sync);
+		scene.gather(ents);
+	}
+	load(std::move(scene)); // resets the statistics
+	statistics.phaseTimes[(uint32)PhysicsPhaseEnum::Sync] = gathering.phaseTimes[(uint32)PhysicsPhaseEnum::Sync];
+}
+
+void PhysicsSimulation::store()
+{
+	PhysicsScene scene;
+	store(scene);
+	PhaseTimer timer(statistics, PhysicsPhaseEnum::Sync);
+	scene.scatter();
+}
+
+void PhysicsSimulation::threadEntry(PhysicsSimulation *sim, uint32 thrIndex, uint32 thrCount)
+{
+	const PhaseEnum phase = sim->phase;
+	Counters &counters = sim->threadCounters[thrIndex];
+	if (phase == PhaseEnum::Springs || phase == PhaseEnum::Constraints)
+	{
+		const uint32 cnt = sim->activeSprings;
+		const uint32 begin = rangeBegin(cnt, thrIndex, thrCount);
+		const uint32 end = rangeBegin(cnt, thrIndex + 1, thrCount);
+		if (phase == PhaseEnum::Springs)
+			sim->springsPhase(begin, end);
+		else
+			sim->constraintsPhase(begin, end);
+	}
+	else
+	{
+		const uint32 cnt = sim->bodies.dynamicCount;
+		const uint32 begin = rangeBegin(cnt, thrIndex, thrCount);
+		const uint32 end = rangeBegin(cnt, thrIndex + 1, thrCount);
+		if (phase == PhaseEnum::Bodies)
+			sim->bodiesPhase(begin, end, counters);
+		else if (phase == PhaseEnum::Contacts)
+			sim->contactsPhase(begin, end, counters);
+		else if (phase == PhaseEnum::Predict)
+			sim->predictPhase(begin, end, counters);
+		else
+			sim->correctionsPhase(begin, end);
+	}
+}
+
+void PhysicsSimulation::springsPhase(uint32 begin, uint32 end)
+{
+	const Real stiffness = 1 / (referenceStep * referenceStep);
+	const Real damping = 1 / referenceStep;
+	for (uint32 i = begin; i < end; i++)
+	{
+		const PhysicsSpring &s = springs[i];
+		const uint32 b1 = s.bodies[0];
+		const uint32 b2 = s.bodies[1];
+		const Real im1 = bodies.invMasses[b1];
+		const Real im2 = bodies.invMasses[b2];
+		CAGE_ASSERT(im1 > 0 || im2 > 0);
+		const Real m = 1 / (im1 + im2); // reduced mass
+		CAGE_ASSERT(m.valid() && m.finite());
+		Vec3 x = bodies.positions[b2] - bodies.positions[b1];
+		if (lengthSquared(x) > 1e-5)
+			x -= normalize(x) * s.restDistance;
+		else
+			x -= Vec3(0, 0, 1) * s.restDistance; // fixed direction keeps the simulation deterministic
+		const Vec3 v = bodies.velocities[b2] - bodies.velocities[b1];
+		springForces[i] = x * (s.stiffness * m * stiffness) + v * (s.damping * m * damping);
+		CAGE_ASSERT(springForces[i].valid());
+	}
+}
+
+// reads positions and velocities only, so that the bodies may be processed in any order
+void PhysicsSimulation::contactsPhase(uint32 begin, uint32 end, Counters &counters)
+{
+	for (uint32 i = begin; i < end; i++)
+	{
+		Vec3 &acc = contactAccelerations[i];
+		acc = Vec3();
+		const Real radius = bodies.radii[i];
+		if (!radius.valid())
+			continue;
+		const Vec3 &position = bodies.positions[i];
+		grid.neighbors(position, [&](uint32 j) {
+			if (bodyGroups[j] == bodyGroups[i])
+				return;
+			if (distance(position, bodies.positions[j]) < radius + bodies.radii[j])
+			{
+				if (j >= bodies.dynamicCount)
+					touchedGroups[i] = min(touchedGroups[i], bodyGroups[j]);
+				if (j > i)
+					counters.contacts++; // pairs with sleeping bodies are found only from the dynamic side
+			}
+			// sleeping bodies do not move before they are woken at the end of the update, so they are immovable until then
+			const Real im2 = j < bodies.dynamicCount ? bodies.invMasses[j] : Real(0);
+			acc += contactResponse(position, bodies.velocities[i], radius, bodies.invMasses[i], bodies.positions[j], bodies.velocities[j], bodies.radii[j], im2, Vec3(0, 0, i < j ? -1 : 1));
+		});
+		CAGE_ASSERT(acc.valid());
+	}
+}
+
+Vec3 PhysicsSimulation::collisions(uint32 i, Counters &counters)
+{
+	const Real radius = bodies.radii[i];
+	if (!radius.valid())
+		return {};
+	Vec3 &position = bodies.positions[i];
+	Vec3 acc = contactAccelerations[i];
+	Real to;
+	if (heightfield)
+	{
+		// the terrain is locally approximated by its tangent plane
+		Vec2 gradient;
+		to = heightfield->sample(Vec2(position), gradient);
+		const Vec3 n = normalize(Vec3(-gradient, 1));
+		const Real dist = (position[2] - to) * n[2];
+		if (dist < radius)
+		{
+			acc += surfaceResponse(bodies.velocities[i], n, n, radius - dist);
+			counters.contacts++;
+		}
+	}
+	else
+	{
+		const uint32 q = bodyTerrainQueries[i];
+		const bool swept = terrainSpheres[q].radius > radius; // the query covers the whole path of the body
+		for (uint32 k = terrain.offsets[q]; k < terrain.offsets[q + 1]; k++)
+		{
+			const Triangle &tr = terrain.triangles[k];
+			if (swept && distance(position, closestPoint(tr, position)) >= radius)
+				continue;
+			acc += collisionResponse(position, bodies.velocities[i], radius, tr);
+		}
+		to = terrainOffset(Vec2(position));
+	}
+	{ // ensure that the object is in front of the wall
+		// it is intended to correct objects that has fallen behind the wall before the wall was generated
+		// but it is not physical
+		if (position[2] < to - radius * 0.5)
+		{
+			position[2] = to + radius;
+			counters.corrections++;
+		}
+	}
+	return acc;
+}
+
+// signed distance of the center from the terrain, using the same terrain representation as the collisions
+Real PhysicsSimulation::terrainDistance(uint32 i, const Vec3 &position, Vec3 &normal) const
+{
+	if (heightfield)
+	{
+		Vec2 gradient;
+		const Real h = heightfield->sample(Vec2(position), gradient);
+		normal = normalize(Vec3(-gradient, 1));
+		return (position[2] - h) * normal[2];
+	}
+	Real result = Real::Infinity();
+	const uint32 q = bodyTerrainQueries[i];
+	for (uint32 k = terrain.offsets[q]; k < terrain.offsets[q + 1]; k++)
+	{
+		const Triangle &tr = terrain.triangles[k];
+		const Vec3 cp = closestPoint(tr, position);
+		const Real d = distance(position, cp);
+		if (d < abs(result))
+		{
+			normal = tr.normal();
+			result = dot(position - cp, normal) < 0 ? -d : d;
+		}
+	}
+	return result;
+}
+
+// samples the path of a fast body in steps of half of its radius, and stops the body where it first touches the surface
+// the center is tested against the surface offset by the radius, which the half radius steps cannot skip over
+// a body that starts in contact is stopped only when it gets deeper by a tenth of its radius, so that it can slide along the surface
+void PhysicsSimulation::sweep(uint32 i, const Vec3 &from)
+{
+	const Real radius = bodies.radii[i];
+	Vec3 &position = bodies.positions[i];
+	const Vec3 travel = position - from;
+	const Real len = length(travel);
+	if (!(len > radius))
+		return; // slow bodies and bodies that do not collide
+	const uint32 steps = min(numeric_cast<uint32>(ceil(len / (radius * 0.5)).value), 64u);
+	Vec3 n;
+	// distances are clamped, so that a missing surface stays finite and the interpolation only stops the body earlier
+	Real prev = min(terrainDistance(i, from, n), radius * 2);
+	const Real contact = prev < radius ? prev - radius * 0.1 : radius;
+	for (uint32 k = 1; k <= steps; k++)
+	{
+		const Real d = min(terrainDistance(i, from + travel * (Real(k) / steps), n), radius * 2);
+		if (d < contact)
+		{
+			const Real t = prev > contact ? (prev - contact) / (prev - d) : Real(0); // interpolated to the touching point
+			position = from + travel * ((k - 1 + t) / steps);
+			Vec3 &v = bodies.velocities[i];
+			const Real approach = dot(v, n);
+			if (approach < 0)
+				v -= n * approach * 1.9; // same restitution as the contacts
+			return;
+		}
+		prev = d;
+	}
+}
+
+void PhysicsSimulation::bodiesPhase(uint32 begin, uint32 end, Counters &counters)
+{
+	const Real damping = physicsDamping(deltaTime, referenceStep);
+	const Vec3 g = Vec3(0, -9.8, 0);
+	for (uint32 i = begin; i < end; i++)
+	{
+		Vec3 &acc = bodies.accelerations[i];
+		acc += springsSum(i) * bodies.invMasses[i];
+		acc += g;
+		acc += collisions(i, counters);
+		CAGE_ASSERT(acc.valid());
+		Vec3 &v = bodies.velocities[i];
+		v *= damping;
+		v += acc * deltaTime;
+		const Vec3 from = bodies.positions[i];
+		bodies.positions[i] += v * deltaTime;
+		if (continuousCollisions)
+			sweep(i, from);
+	}
+}
+
+// sum of the slots of all springs attached to the body, in fixed order
+Vec3 PhysicsSimulation::springsSum(uint32 i) const
+{
+	Vec3 sum;
+	for (uint32 k = bodySpringsOffsets[i]; k < bodySpringsOffsets[i + 1]; k++)
+	{
+		const uint32 s = bodySprings[k];
+		const Vec3 &f = springForces[s / 2];
+		if (s % 2)
+			sum -= f;
+		else
+			sum += f;
+	}
+	return sum;
+}
+
+void PhysicsSimulation::predictPhase(uint32 begin, uint32 end, Counters &counters)
+{
+	const Real h = deltaTime * repeatSteps;
+	const Real damping = physicsDamping(h, referenceStep); // same velocity damping per update as the explicit solver
+	const Vec3 g = Vec3(0, -9.8, 0);
+	for (uint32 i = begin; i < end; i++)
+	{
+		const Vec3 acc = g + collisions(i, counters);
+		CAGE_ASSERT(acc.valid());
+		Vec3 &v = bodies.velocities[i];
+		v *= damping;
+		v += acc * h;
+		previousPositions[i] = bodies.positions[i];
+		bodies.positions[i] += v * h;
+		if (continuousCollisions)
+			sweep(i, previousPositions[i]);
+	}
+}
+
+// the explicit spring with stiffness s and damping d relative to the reference step t corresponds to
+// xpbd compliance t^2 / (s * m) and damping coefficient d * m / t, expressed for the step h = dt * repeatSteps
+// jacobi iterations scale the correction of each spring by the larger number of springs of its moving bodies,
+// so that the multiplier accumulates exactly the correction that is applied to both bodies
+void PhysicsSimulation::constraintsPhase(uint32 begin, uint32 end)
+{
+	const Real h = deltaTime * repeatSteps;
+	const Real r = referenceStep / h;
+	const auto &degree = [&](uint32 b) -> uint32 {
+		return b < bodies.dynamicCount ? bodySpringsOffsets[b + 1] - bodySpringsOffsets[b] : 1;
+	};
+	for (uint32 i = begin; i < end; i++)
+	{
+		const PhysicsSpring &s = springs[i];
+		const uint32 b1 = s.bodies[0];
+		const uint32 b2 = s.bodies[1];
+		const Real w = bodies.invMasses[b1] + bodies.invMasses[b2];
+		CAGE_ASSERT(w > 0);
+		const Vec3 x = bodies.positions[b2] - bodies.positions[b1];
+		const Real len = length(x);
+		const Vec3 n = len > 1e-5 ? x / len : Vec3(0, 0, 1);
+		const Real c = len - s.restDistance;
+		const Real alpha = w * r * r / s.stiffness; // compliance divided by h^2
+		const Real gamma = s.damping * r / s.stiffness;
+		Vec3 moved; // relative displacement since the beginning of the step, static bodies do not move
+		if (b1 < bodies.dynamicCount)
+			moved -= bodies.positions[b1] - previousPositions[b1];
+		if (b2 < bodies.dynamicCount)
+			moved += bodies.positions[b2] - previousPositions[b2];
+		Real &lambda = springLambdas[i];
+		const Real dl = -(c + alpha * lambda + gamma * dot(n, moved)) / ((1 + gamma) * w + alpha) / max(degree(b1), degree(b2));
+		lambda += dl;
+		springForces[i] = -n * dl;
+		CAGE_ASSERT(springForces[i].valid());
+	}
+}
+
+// the corrections of the springs are already scaled for the jacobi iterations
+void PhysicsSimulation::correctionsPhase(uint32 begin, uint32 end)
+{
+	const Real h = deltaTime * repeatSteps;
+	for (uint32 i = begin; i < end; i++)
+	{
+		if (bodySpringsOffsets[i + 1] == bodySpringsOffsets[i])
+			continue;
+		bodies.positions[i] += springsSum(i) * bodies.invMasses[i];
+		bodies.velocities[i] = (bodies.positions[i] - previousPositions[i]) / h; // overwritten by every iteration, the last one is kept
+	}
+}
+
+// accelerations accumulate over all steps of one update
+void PhysicsSimulation::runExplicit()
+{
+	for (uint32 step = 0; step < repeatSteps; step++)
+	{
+		runContacts();
+		runTerrain();
+		{
+			PhaseTimer timer(statistics, PhysicsPhaseEnum::Springs);
+			runPhase(PhaseEnum::Springs);
+		}
+		{
+			PhaseTimer timer(statistics, PhysicsPhaseEnum::Bodies);
+			runPhase(PhaseEnum::Bodies);
+			statistics.terrainContacts += takeCounters();
+		}
+	}
+}
+
+void PhysicsSimulation::runContacts()
+{
+	PhaseTimer timer(statistics, PhysicsPhaseEnum::Contacts);
+	grid.build(bodies);
+	if (grid.items.empty())
+		return;
+	runPhase(PhaseEnum::Contacts);
+	statistics.contactPairs += takeCounters();
+}
+
+// batched queries of the colliding bodies against the terrain triangles, at positions from the beginning of the step
+// with continuous collisions, the spheres of fast bodies are enlarged to cover their expected path, with a margin for the accelerations during the step
+void PhysicsSimulation::runTerrain()
+{
+	if (heightfield)
+		return;
+	PhaseTimer timer(statistics, PhysicsPhaseEnum::Terrain);
+	const Real h = solver == PhysicsSolverEnum::Xpbd ? deltaTime * repeatSteps : deltaTime;
+	bodyTerrainQueries.clear();
+	bodyTerrainQueries.resize(bodies.dynamicCount, (uint32)m);
+	terrainSpheres.clear();
+	for (uint32 i = 0; i < bodies.dynamicCount; i++)
+	{
+		const Real radius = bodies.radii[i];
+		if (!radius.valid())
+			continue;
+		bodyTerrainQueries[i] = numeric_cast<uint32>(terrainSpheres.size());
+		const Real travel = continuousCollisions ? (length(bodies.velocities[i]) * 1.5 + 9.8 * h) * h : Real();
+		terrainSpheres.push_back(Sphere(bodies.positions[i], travel > radius ? radius + travel : radius));
+	}
+	terrain.spheres(terrainSpheres);
+	statistics.terrainContacts += numeric_cast<uint32>(terrain.triangles.size());
+}
+
+void PhysicsSimulation::runXpbd()
+{
+	CAGE_ASSERT(iterations > 0);
+	std::fill(springLambdas.begin(), springLambdas.end(), Real());
+	runContacts();
+	runTerrain();
+	{
+		PhaseTimer timer(statistics, PhysicsPhaseEnum::Predict);
+		runPhase(PhaseEnum::Predict);
+		statistics.terrainContacts += takeCounters();
+	}
+	for (uint32 it = 0; it < iterations; it++)
+	{
+		{
+			PhaseTimer timer(statistics, PhysicsPhaseEnum::Constraints);
+			runPhase(PhaseEnum::Constraints);
+		}
+		{
+			PhaseTimer timer(statistics, PhysicsPhaseEnum::Corrections);
+			runPhase(PhaseEnum::Corrections);
+		}
+	}
+}
+
+void PhysicsSimulation::run()
+{
+	if (solver == PhysicsSolverEnum::Xpbd)
+		runXpbd();
+	else
+		runExplicit();
+}
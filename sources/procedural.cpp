@@ -1,59 +1,92 @@
 #include "common.h"
+#include "noise.h"
 
 #include <cage-core/geometry.h>
-#include <cage-core/noiseFunction.h>
 #include <cage-core/color.h>
 #include <cage-core/random.h>
 
-#include <array>
 #include <algorithm>
+#include <limits>
+#include <vector>
 
 namespace
 {
-	const uint32 GlobalSeed = (uint32)detail::randomGenerator().next();
+	using noise::Span;
+	using noise::SpanSize;
 
-	uint32 newSeed()
+	// deterministic sequence of seeds for the individual noises
+	struct SeedSequence
 	{
-		static uint32 index = 35741890;
-		index = hash(index);
-		return GlobalSeed + index;
-	}
+		uint32 seed = 0;
+		uint32 index = 35741890;
 
-	Holder<NoiseFunction> newClouds(uint32 octaves)
-	{
-		NoiseFunctionCreateConfig cfg;
-		cfg.seed = newSeed();
-		cfg.octaves = octaves;
-		cfg.type = NoiseTypeEnum::Value;
-		return newNoiseFunction(cfg);
-	}
+		uint32 next()
+		{
+			index = hash(index);
+			return seed + index;
+		}
+	};
 
-	Holder<NoiseFunction> newValue()
+	// near the center of a cell, the nearest feature point is always the one of the cell itself, because the offsets are shorter than half of a cell
+	// distances to two points on opposite sides of the center then give the offset along that axis
+	// all cells with the same index must have the same offset, which verifies the hashing, also in release builds
+	template<uint32 N, class V>
+	void recoverCellOffsets(Holder<NoiseFunction> &library, const V &center, uint32 hash, float *vecs, uint32 *counts)
 	{
-		return newClouds(0);
+		constexpr float Step = 0.05f;
+		const uint32 index = hash & (255 << (N - 1));
+		for (uint32 axis = 0; axis < N; axis++)
+		{
+			V step;
+			step[axis] = Step;
+			const float a = library->evaluate(center - step).value + 1;
+			const float b = library->evaluate(center + step).value + 1;
+			const float o = (a * a - b * b) / (4 * Step);
+			if (counts[index] != 0 && !(abs(Real(vecs[index + axis] / counts[index] - o)) < 1e-3))
+				CAGE_THROW_ERROR(Exception, "inconsistent cellular noise offsets, the library hashing differs");
+			vecs[index + axis] += o;
+		}
+		counts[index]++;
 	}
 
-	Holder<NoiseFunction> newCell(NoiseOperationEnum operation = NoiseOperationEnum::Distance, NoiseDistanceEnum distance = NoiseDistanceEnum::Euclidean)
+	noise::CellOffsets recoverCellOffsets()
 	{
 		NoiseFunctionCreateConfig cfg;
-		cfg.seed = newSeed();
+		cfg.seed = 0; // the probed cells are hashed with seed 0
+		cfg.frequency = 1;
 		cfg.type = NoiseTypeEnum::Cellular;
-		cfg.operation = operation;
-		cfg.distance = distance;
-		return newNoiseFunction(cfg);
-	}
-
-	template<class T>
-	Real evaluateOrig(Holder<NoiseFunction> &noiseFunction, const T &position)
-	{
-		return noiseFunction->evaluate(position);
+		cfg.operation = NoiseOperationEnum::Distance;
+		cfg.distance = NoiseDistanceEnum::Euclidean;
+		Holder<NoiseFunction> library = newNoiseFunction(cfg);
+		noise::CellOffsets r;
+		uint32 counts2[512] = {}, counts3[1024] = {};
+		for (sint32 x = -32; x <= 32; x++)
+			for (sint32 y = -32; y <= 32; y++)
+				recoverCellOffsets<2>(library, Vec2(x, y), noise::hashCoord(0, (uint32)x * noise::PrimeX, (uint32)y * noise::PrimeY), r.vecs2, counts2);
+		for (sint32 x = -7; x <= 7; x++)
+			for (sint32 y = -7; y <= 7; y++)
+				for (sint32 z = -7; z <= 7; z++)
+					recoverCellOffsets<3>(library, Vec3(x, y, z), noise::hashCoord(0, (uint32)x * noise::PrimeX, (uint32)y * noise::PrimeY, (uint32)z * noise::PrimeZ), r.vecs3, counts3);
+		for (uint32 i = 0; i < 256; i++)
+		{
+			if (counts2[i * 2] == 0 || counts3[i * 4] == 0)
+				CAGE_THROW_ERROR(Exception, "incomplete cellular noise offsets");
+			for (uint32 a = 0; a < 2; a++)
+				r.vecs2[i * 2 + a] /= counts2[i * 2];
+			for (uint32 a = 0; a < 3; a++)
+				r.vecs3[i * 4 + a] /= counts3[i * 4];
+		}
+		return r;
 	}
 
-	template<class T>
-	Real evaluateClamp(Holder<NoiseFunction> &noiseFunction, const T &position)
-	{
-		return noiseFunction->evaluate(position) * 0.5 + 0.5;
-	}
+	using Clouds2 = noise::Clouds<2>;
+	using Clouds3 = noise::Clouds<3>;
+	using Clouds4 = noise::Clouds<4>;
+	using Clouds5 = noise::Clouds<5>;
+	using Value = noise::Clouds<0>;
+	using CellDistance = noise::Cell<NoiseOperationEnum::Distance>;
+	using CellDistance2 = noise::Cell<NoiseOperationEnum::Distance2>;
+	using CellSubtract = noise::Cell<NoiseOperationEnum::Subtract>;
 
 	Real rerange(Real v, Real ia, Real ib, Real oa, Real ob)
 	{
@@ -71,7 +104,7 @@ namespace
 	}
 
 	template<uint32 N, class T>
-	T ninterpolate(const T v[N], Real f) 
+	T ninterpolate(const T v[N], Real f)
 	{
 		CAGE_ASSERT(f >= 0 && f < 1);
 		f *= (N - 1); // 0..(N-1)
@@ -80,76 +113,438 @@ namespace
 		return interpolate(v[i], v[i + 1], f - i);
 	}
 
-	Vec3 recolor(const Vec3 &color, Real deviation, const Vec3 &pos)
+	template<class T>
+	T slab(T v)
+	{
+		constexpr float Pi = 3.14159265358979f;
+		v = noise::mod(v, 1);
+		if (v > 0.8f)
+			return noise::sin((v - 0.8f) * (Pi / 0.2f) + Pi * 0.5f);
+		return v / 0.8f;
+	}
+
+	struct TerrainOffsetNoises
 	{
-		static Holder<NoiseFunction> value1 = newValue();
-		static Holder<NoiseFunction> value2 = newValue();
-		static Holder<NoiseFunction> value3 = newValue();
+		SeedSequence seeds;
+		Clouds3 clouds1 = { seeds.next() };
+		Clouds3 clouds2 = { seeds.next() };
+		Clouds3 clouds3 = { seeds.next() };
+		Clouds3 clouds4 = { seeds.next() };
+		Clouds3 clouds5 = { seeds.next() };
+		Clouds3 clouds6 = { seeds.next() };
+		Clouds3 clouds7 = { seeds.next() };
+		Clouds3 clouds8 = { seeds.next() };
+		Clouds3 clouds9 = { seeds.next() };
+		Clouds3 clouds10 = { seeds.next() };
+		CellDistance cell1 = { seeds.next() };
+		CellSubtract cell2 = { seeds.next() };
+	};
+
+	// the whole height function composed at compile time
+	// all noises and shaping functions are inlined, so the compiler can fold the constants and interleave the layers
+	template<class T>
+	T terrainOffsetKernel(const TerrainOffsetNoises &n, const T x, const T y)
+	{
+		T result = y * -0.2f; // slope
+
+		{ // horizontal slabs
+			const T off = noise::evaluateClamp(n.clouds1, x * 0.0065f, y * 0.0065f);
+			const T mask = noise::evaluateClamp(n.clouds2, x * 0.00715f, y * 0.00715f);
+			result += slab(y * 0.027f + off * 2.5f) * noise::sharpEdge(mask * 2 - 0.7f) * 5;
+		}
+
+		{ // extra saliences
+			const T a = noise::evaluateClamp(n.cell1, x * 0.0241f, y * 0.0241f);
+			const T b = n.clouds3.evaluate(x * 0.041f, y * 0.041f);
+			result += noise::sharpEdge(a + b - 0.4f);
+		}
 
-		Real h = evaluateClamp(value1, pos) * 0.5 + 0.25;
-		Real s = evaluateClamp(value2, pos);
-		Real v = evaluateClamp(value3, pos);
-		Vec3 hsv = colorRgbToHsv(color) + (Vec3(h, s, v) - 0.5) * deviation;
-		hsv[0] = (hsv[0] + 1) % 1;
-		return colorHsvToRgb(clamp(hsv, 0, 1));
+		{ // medium-frequency waves
+			const T scl = noise::evaluateClamp(n.clouds4, x * 0.00921f, y * 0.00921f) + 0.5f;
+			const T rot = noise::evaluateClamp(n.clouds5, x * 0.00398f, y * 0.00398f);
+			const T mask = noise::evaluateClamp(n.clouds6, x * 0.00654f, y * 0.00654f);
+			const T a = noise::evaluateClamp(n.cell2, (x * 0.01f + rot + 0.5f) * scl, (y * 0.01f - rot + 1.5f) * scl);
+			const T w = (noise::min(a + 0.95f, 1.f) - 0.95f) * 20;
+			result += w * w * w * noise::sharpEdge(mask - 0.1f) * 0.5f;
+		}
+
+		{ // high-frequency x-aligned cracks
+			const T a = noise::pow(noise::evaluateClamp(n.clouds7, x * 0.036f, y * 0.13f), 0.2f);
+			const T b = noise::pow(noise::evaluateClamp(n.clouds8, x * 0.047f, y * 0.029f), 0.1f);
+			result += noise::min(a, b) * 3;
+		}
+
+		{ // medium-frequency y-aligned cracks
+			const T a = noise::pow(noise::evaluateClamp(n.clouds9, x * 0.055f, y * 0.0135f), 0.2f);
+			const T b = noise::pow(noise::evaluateClamp(n.clouds10, x * 0.0165f, y * 0.0255f), 0.1f);
+			result += noise::min(a, b) * 3;
+		}
+
+		return result;
 	}
 
-	void darkRockGeneral(const Vec3 &pos, Vec3 &color, Real &roughness, Real &metallic, const Vec3 *colors, uint32 colorsCount)
+	NOISE_TARGET_CLONES void terrainOffsetSpan(const TerrainOffsetNoises n, const float *__restrict x, const float *__restrict y, float *__restrict result, uint32 count)
 	{
-		static Holder<NoiseFunction> clouds1 = newClouds(3);
-		static Holder<NoiseFunction> clouds2 = newClouds(3);
-		static Holder<NoiseFunction> clouds3 = newClouds(3);
-		static Holder<NoiseFunction> clouds4 = newClouds(3);
-		static Holder<NoiseFunction> clouds5 = newClouds(3);
+		for (uint32 i = 0; i < count; i++)
+			result[i] = terrainOffsetKernel(n, x[i], y[i]);
+	}
 
-		Vec3 off = Vec3(evaluateClamp(clouds1, pos * 0.065), evaluateClamp(clouds2, pos * 0.104), evaluateClamp(clouds3, pos * 0.083));
-		Real f = evaluateClamp(clouds4, pos * 0.0756 + off);
-		switch (colorsCount)
+	// height together with its exact derivatives along both axes
+	NOISE_TARGET_CLONES void terrainOffsetSpan(const TerrainOffsetNoises n, const float *__restrict x, const float *__restrict y, float *__restrict result, float *__restrict dx, float *__restrict dy, uint32 count)
+	{
+		for (uint32 i = 0; i < count; i++)
 		{
-		case 3: color = ninterpolate<3>(colors, f); break;
-		case 4: color = ninterpolate<4>(colors, f); break;
-		default: CAGE_THROW_CRITICAL(NotImplemented, "unsupported colorsCount");
+			const noise::Grad2 r = terrainOffsetKernel(n, noise::Grad2{ x[i], 1, 0 }, noise::Grad2{ y[i], 0, 1 });
+			result[i] = r.v;
+			dx[i] = r.dx;
+			dy[i] = r.dy;
 		}
-		color = recolor(color, 0.1, pos * 2.1);
-		roughness = evaluateClamp(clouds5, pos * 1.132) * 0.4 + 0.3;
-		metallic = 0.02;
 	}
 
-	void basePaper(const Vec3 &pos, Vec3 &color, Real &roughness, Real &metallic)
+	// evaluates the noise, remapped to 0 .. 1, at all positions of the span multiplied by the frequency
+	template<class Noise>
+	NOISE_TARGET_CLONES void evaluateSpan(const Noise noise, float frequency, const Span &span, float *__restrict result)
 	{
-		static Holder<NoiseFunction> clouds1 = newClouds(5);
-		static Holder<NoiseFunction> clouds2 = newClouds(5);
-		static Holder<NoiseFunction> clouds3 = newClouds(5);
-		static Holder<NoiseFunction> clouds4 = newClouds(3);
-		static Holder<NoiseFunction> clouds5 = newClouds(3);
-		static Holder<NoiseFunction> cell1 = newCell(NoiseOperationEnum::Distance2, NoiseDistanceEnum::Euclidean);
-		static Holder<NoiseFunction> cell2 = newCell(NoiseOperationEnum::Distance2, NoiseDistanceEnum::Euclidean);
-		static Holder<NoiseFunction> cell3 = newCell(NoiseOperationEnum::Distance2, NoiseDistanceEnum::Euclidean);
+		const uint32 cnt = span.count;
+		for (uint32 i = 0; i < cnt; i++)
+			result[i] = noise.evaluate(span.x[i] * frequency, span.y[i] * frequency, span.z[i] * frequency) * 0.5f + 0.5f;
+	}
 
-		Vec3 off = Vec3(evaluateClamp(cell1, pos * 0.063), evaluateClamp(cell2, pos * 0.063), evaluateClamp(cell3, pos * 0.063));
-		if (evaluateClamp(clouds4, pos * 0.097 + off * 2.2) < 0.6)
-		{ // rock 1
-			color = colorHsvToRgb(Vec3(
-				evaluateClamp(clouds1, pos * 0.134) * 0.01 + 0.08,
-				evaluateClamp(clouds2, pos * 0.344) * 0.2 + 0.2,
-				evaluateClamp(clouds3, pos * 0.100) * 0.4 + 0.55
-			));
-			roughness = evaluateClamp(clouds5, pos * 0.848) * 0.5 + 0.3;
-			metallic = 0.02;
+	// positions of the span multiplied by the frequency and displaced by the offsets
+	void displaceSpan(const Span &span, float frequency, const float *ox, const float *oy, const float *oz, float offsetScale, Span &result)
+	{
+		const uint32 cnt = span.count;
+		for (uint32 i = 0; i < cnt; i++)
+		{
+			result.x[i] = span.x[i] * frequency + ox[i] * offsetScale;
+			result.y[i] = span.y[i] * frequency + oy[i] * offsetScale;
+			result.z[i] = span.z[i] * frequency + oz[i] * offsetScale;
+		}
+		result.count = cnt;
+	}
+
+	// copies the positions where the mask is set into a new span and remembers their original indices
+	void compactSpan(const Span &span, const bool *mask, Span &result, uint32 *indices)
+	{
+		result.count = 0;
+		for (uint32 i = 0; i < span.count; i++)
+		{
+			if (!mask[i])
+				continue;
+			indices[result.count] = i;
+			result.push(span.x[i], span.y[i], span.z[i]);
+		}
+	}
+
+	// low frequency noise sampled on a coarse lattice covering a box and trilinearly interpolated
+	// the spacing is derived from the curvature of the noise, so the interpolation error (of the noise remapped to 0 .. 1) stays below the tolerance
+	struct CoarseField
+	{
+		float origin[3] = {};
+		float invStep = 0;
+		uint32 res[3] = {};
+		std::vector<float> values;
+
+		template<class Noise>
+		static float latticeStep(float frequency, float tolerance)
+		{
+			// trilinear error along each axis is at most step^2 / 8 times the second derivative, the remapping halves the curvature
+			return std::sqrt(tolerance * 8 / (3 * Noise::Curvature * 0.5f)) / frequency;
+		}
+
+		static uint64 nodesCount(const float lo[3], const float hi[3], float step)
+		{
+			uint64 r = 1;
+			for (uint32 a = 0; a < 3; a++)
+				r *= (uint64)((hi[a] - lo[a]) / step) + 2;
+			return r;
+		}
+
+		template<class Noise>
+		void build(const Noise &noise, float frequency, const float lo[3], const float hi[3], float step)
+		{
+			invStep = 1 / step;
+			for (uint32 a = 0; a < 3; a++)
+			{
+				origin[a] = lo[a];
+				res[a] = (uint32)((hi[a] - lo[a]) * invStep) + 2;
+			}
+			values.resize(res[0] * res[1] * res[2]);
+			Span span;
+			uint32 index = 0;
+			for (uint32 z = 0; z < res[2]; z++)
+			{
+				for (uint32 y = 0; y < res[1]; y++)
+				{
+					for (uint32 x = 0; x < res[0]; x++)
+					{
+						span.push(origin[0] + x * step, origin[1] + y * step, origin[2] + z * step);
+						if (span.count == SpanSize)
+						{
+							evaluateSpan(noise, frequency, span, values.data() + index);
+							index += span.count;
+							span.count = 0;
+						}
+					}
+				}
+			}
+			evaluateSpan(noise, frequency, span, values.data() + index);
+		}
+
+		void evaluate(const Span &span, float *result) const
+		{
+			const uint32 sy = res[0];
+			const uint32 sz = res[0] * res[1];
+			for (uint32 i = 0; i < span.count; i++)
+			{
+				const float fx = (span.x[i] - origin[0]) * invStep;
+				const float fy = (span.y[i] - origin[1]) * invStep;
+				const float fz = (span.z[i] - origin[2]) * invStep;
+				const uint32 x = min((uint32)noise::max(fx, 0), res[0] - 2);
+				const uint32 y = min((uint32)noise::max(fy, 0), res[1] - 2);
+				const uint32 z = min((uint32)noise::max(fz, 0), res[2] - 2);
+				const float tx = fx - x, ty = fy - y, tz = fz - z;
+				const float *v = values.data() + z * sz + y * sy + x;
+				const float x00 = noise::lerp(v[0], v[1], tx);
+				const float x10 = noise::lerp(v[sy], v[sy + 1], tx);
+				const float x01 = noise::lerp(v[sz], v[sz + 1], tx);
+				const float x11 = noise::lerp(v[sz + sy], v[sz + sy + 1], tx);
+				result[i] = noise::lerp(noise::lerp(x00, x10, ty), noise::lerp(x01, x11, ty), tz);
+			}
 		}
+	};
+
+	// uses the coarse field when it was built
+	template<class Noise>
+	void evaluateSpan(const CoarseField *field, const Noise &noise, float frequency, const Span &span, float *result)
+	{
+		if (field && !field->values.empty())
+			field->evaluate(span, result);
 		else
+			evaluateSpan(noise, frequency, span, result);
+	}
+
+	struct MaterialSpan
+	{
+		Vec3 color[SpanSize];
+		Real roughness[SpanSize];
+		Real metallic[SpanSize];
+	};
+
+	struct RecolorNoises
+	{
+		SeedSequence seeds;
+		Value value1 = { seeds.next() };
+		Value value2 = { seeds.next() };
+		Value value3 = { seeds.next() };
+	};
+
+	struct DarkRockNoises
+	{
+		SeedSequence seeds;
+		Clouds3 clouds1 = { seeds.next() };
+		Clouds3 clouds2 = { seeds.next() };
+		Clouds3 clouds3 = { seeds.next() };
+		Clouds3 clouds4 = { seeds.next() };
+		Clouds3 clouds5 = { seeds.next() };
+	};
+
+	struct PaperNoises
+	{
+		SeedSequence seeds;
+		Clouds5 clouds1 = { seeds.next() };
+		Clouds5 clouds2 = { seeds.next() };
+		Clouds5 clouds3 = { seeds.next() };
+		Clouds3 clouds4 = { seeds.next() };
+		Clouds3 clouds5 = { seeds.next() };
+		CellDistance2 cell1 = { seeds.next() };
+		CellDistance2 cell2 = { seeds.next() };
+		CellDistance2 cell3 = { seeds.next() };
+	};
+
+	struct SphinxNoises
+	{
+		SeedSequence seeds;
+		Clouds4 clouds1 = { seeds.next() };
+		Clouds3 clouds2 = { seeds.next() };
+	};
+
+	struct WhiteNoises
+	{
+		SeedSequence seeds;
+		Clouds3 clouds1 = { seeds.next() };
+		Clouds3 clouds2 = { seeds.next() };
+		Clouds3 clouds3 = { seeds.next() };
+		Clouds3 clouds4 = { seeds.next() };
+		Value value1 = { seeds.next() };
+	};
+
+	struct DarkRock1Noises
+	{
+		SeedSequence seeds;
+		Clouds3 clouds1 = { seeds.next() };
+		Clouds3 clouds2 = { seeds.next() };
+		Clouds3 clouds3 = { seeds.next() };
+		Clouds3 clouds4 = { seeds.next() };
+		Clouds3 clouds5 = { seeds.next() };
+		CellSubtract cell1 = { seeds.next() };
+		Value value1 = { seeds.next() };
+	};
+
+	struct TerrainMaterialNoises
+	{
+		SeedSequence seeds;
+		Clouds3 weights[5] = { { seeds.next() }, { seeds.next() }, { seeds.next() }, { seeds.next() }, { seeds.next() } };
+		RecolorNoises recolor = { { seeds.next() } };
+		DarkRockNoises darkRock = { { seeds.next() } };
+		PaperNoises paper = { { seeds.next() } };
+		SphinxNoises sphinx = { { seeds.next() } };
+		WhiteNoises white = { { seeds.next() } };
+		DarkRock1Noises darkRock1 = { { seeds.next() } };
+		Clouds3 clouds1 = { seeds.next() };
+		Clouds2 clouds2 = { seeds.next() };
+		Clouds3 clouds3 = { seeds.next() };
+		Clouds3 clouds4 = { seeds.next() };
+		Clouds3 clouds5 = { seeds.next() };
+		Clouds3 clouds6 = { seeds.next() };
+		CellSubtract cell1 = { seeds.next() };
+		CellDistance cell2 = { seeds.next() };
+		CellDistance2 cell3 = { seeds.next() };
+		CellDistance2 cell4 = { seeds.next() };
+		CellDistance2 cell5 = { seeds.next() };
+		CellSubtract cell6 = { seeds.next() };
+		Value value1 = { seeds.next() };
+		Value value2 = { seeds.next() };
+		Value value3 = { seeds.next() };
+	};
+
+	// the layers of terrain material with frequencies low enough to be sampled on a coarse lattice
+	struct LowFrequencyFields
+	{
+		CoarseField weights[5];
+		CoarseField sphinx;
+		CoarseField veins;
+		CoarseField largeCracks;
+		CoarseField grass;
+
+		// calls the function with each field together with its noise and frequency
+		template<class F>
+		void each(const TerrainMaterialNoises &n, bool rockOnly, F &&f)
+		{
+			for (uint32 b = 0; b < 5; b++)
+				f(weights[b], n.weights[b], 0.01f);
+			f(sphinx, n.sphinx.clouds1, 0.0041f);
+			f(veins, n.darkRock1.clouds4, 0.018f);
+			if (rockOnly)
+				return;
+			f(largeCracks, n.clouds3, 0.023f);
+			f(grass, n.clouds4, 0.015f);
+		}
+
+		// each lattice is built only when it is cheaper than evaluating all the positions directly
+		void build(const TerrainMaterialNoises &n, const float lo[3], const float hi[3], float tolerance, bool rockOnly, uint32 positionsCount)
+		{
+			each(n, rockOnly, [&](CoarseField &field, const auto &noise, float frequency) {
+				buildField(field, noise, frequency, lo, hi, tolerance, positionsCount);
+			});
+		}
+
+		template<class Noise>
+		static void buildField(CoarseField &field, const Noise &noise, float frequency, const float lo[3], const float hi[3], float tolerance, uint32 positionsCount)
+		{
+			const float step = CoarseField::latticeStep<Noise>(frequency, tolerance);
+			if (CoarseField::nodesCount(lo, hi, step) < positionsCount)
+				field.build(noise, frequency, lo, hi, step);
+		}
+	};
+
+	void recolor(const RecolorNoises &n, const Span &span, float frequency, Real deviation, MaterialSpan &m)
+	{
+		float h[SpanSize], s[SpanSize], v[SpanSize];
+		evaluateSpan(n.value1, frequency, span, h);
+		evaluateSpan(n.value2, frequency, span, s);
+		evaluateSpan(n.value3, frequency, span, v);
+		for (uint32 i = 0; i < span.count; i++)
+		{
+			Vec3 hsv = colorRgbToHsv(m.color[i]) + (Vec3(h[i] * 0.5f + 0.25f, s[i], v[i]) - 0.5) * deviation;
+			hsv[0] = (hsv[0] + 1) % 1;
+			m.color[i] = colorHsvToRgb(clamp(hsv, 0, 1));
+		}
+	}
+
+	template<uint32 N>
+	void darkRockGeneral(const TerrainMaterialNoises &n, const Span &span, MaterialSpan &m, const Vec3 (&colors)[N])
+	{
+		const DarkRockNoises &d = n.darkRock;
+		float ox[SpanSize], oy[SpanSize], oz[SpanSize], f[SpanSize], r[SpanSize];
+		evaluateSpan(d.clouds1, 0.065f, span, ox);
+		evaluateSpan(d.clouds2, 0.104f, span, oy);
+		evaluateSpan(d.clouds3, 0.083f, span, oz);
+		Span p;
+		displaceSpan(span, 0.0756f, ox, oy, oz, 1, p);
+		evaluateSpan(d.clouds4, 1, p, f);
+		evaluateSpan(d.clouds5, 1.132f, span, r);
+		for (uint32 i = 0; i < span.count; i++)
+		{
+			m.color[i] = ninterpolate<N>(colors, f[i]);
+			m.roughness[i] = r[i] * 0.4f + 0.3f;
+			m.metallic[i] = 0.02;
+		}
+		recolor(n.recolor, span, 2.1f, 0.1, m);
+	}
+
+	void basePaper(const TerrainMaterialNoises &n, const Span &span, MaterialSpan &m)
+	{
+		const PaperNoises &d = n.paper;
+		bool rock1[SpanSize];
+		{
+			float ox[SpanSize], oy[SpanSize], oz[SpanSize], f[SpanSize];
+			evaluateSpan(d.cell1, 0.063f, span, ox);
+			evaluateSpan(d.cell2, 0.063f, span, oy);
+			evaluateSpan(d.cell3, 0.063f, span, oz);
+			Span p;
+			displaceSpan(span, 0.097f, ox, oy, oz, 2.2f, p);
+			evaluateSpan(d.clouds4, 1, p, f);
+			for (uint32 i = 0; i < span.count; i++)
+				rock1[i] = f[i] < 0.6f;
+		}
+		Span p;
+		uint32 indices[SpanSize];
+		float h[SpanSize], s[SpanSize], v[SpanSize], r[SpanSize];
+
+		{ // rock 1
+			compactSpan(span, rock1, p, indices);
+			evaluateSpan(d.clouds1, 0.134f, p, h);
+			evaluateSpan(d.clouds2, 0.344f, p, s);
+			evaluateSpan(d.clouds3, 0.100f, p, v);
+			evaluateSpan(d.clouds5, 0.848f, p, r);
+			for (uint32 i = 0; i < p.count; i++)
+			{
+				const uint32 k = indices[i];
+				m.color[k] = colorHsvToRgb(Vec3(h[i] * 0.01f + 0.08f, s[i] * 0.2f + 0.2f, v[i] * 0.4f + 0.55f));
+				m.roughness[k] = r[i] * 0.5f + 0.3f;
+				m.metallic[k] = 0.02;
+			}
+		}
+
 		{ // rock 2
-			color = colorHsvToRgb(Vec3(
-				evaluateClamp(clouds1, pos * 0.321) * 0.02 + 0.094,
-				evaluateClamp(clouds2, pos * 0.258) * 0.3 + 0.08,
-				evaluateClamp(clouds3, pos * 0.369) * 0.2 + 0.59
-			));
-			roughness = 0.5;
-			metallic = 0.049;
+			for (uint32 i = 0; i < span.count; i++)
+				rock1[i] = !rock1[i];
+			compactSpan(span, rock1, p, indices);
+			evaluateSpan(d.clouds1, 0.321f, p, h);
+			evaluateSpan(d.clouds2, 0.258f, p, s);
+			evaluateSpan(d.clouds3, 0.369f, p, v);
+			for (uint32 i = 0; i < p.count; i++)
+			{
+				const uint32 k = indices[i];
+				m.color[k] = colorHsvToRgb(Vec3(h[i] * 0.02f + 0.094f, s[i] * 0.3f + 0.08f, v[i] * 0.2f + 0.59f));
+				m.roughness[k] = 0.5;
+				m.metallic[k] = 0.049;
+			}
 		}
 	}
 
-	void baseSphinx(const Vec3 &pos, Vec3 &color, Real &roughness, Real &metallic)
+	void baseSphinx(const TerrainMaterialNoises &n, const LowFrequencyFields *low, const Span &span, MaterialSpan &m)
 	{
 		// https://www.canstockphoto.com/egyptian-sphinx-palette-26815891.html
 
@@ -160,24 +555,27 @@ namespace
 			pdnToRgb(21, 69, 55)
 		};
 
-		static Holder<NoiseFunction> clouds1 = newClouds(4);
-		static Holder<NoiseFunction> clouds2 = newClouds(3);
-
-		Real off = evaluateClamp(clouds1, pos * 0.0041);
-		Real y = (pos[1] * 0.012 + 1000) % 4;
-		Real c = (y + off * 2 - 1 + 4) % 4;
-		uint32 i = numeric_cast<uint32>(c);
-		Real f = sharpEdge(c - i);
-		if (i < 3)
-			color = interpolate(colors[i], colors[i + 1], f);
-		else
-			color = interpolate(colors[3], colors[0], f);
-		color = recolor(color, 0.1, pos * 1.1);
-		roughness = evaluateClamp(clouds2, pos * 0.941) * 0.3 + 0.4;
-		metallic = 0.02;
+		const SphinxNoises &d = n.sphinx;
+		float off[SpanSize], r[SpanSize];
+		evaluateSpan(low ? &low->sphinx : nullptr, d.clouds1, 0.0041f, span, off);
+		evaluateSpan(d.clouds2, 0.941f, span, r);
+		for (uint32 i = 0; i < span.count; i++)
+		{
+			Real y = Real(span.y[i] * 0.012f + 1000) % 4;
+			Real c = (y + off[i] * 2 - 1 + 4) % 4;
+			uint32 k = numeric_cast<uint32>(c);
+			Real f = sharpEdge(c - k);
+			if (k < 3)
+				m.color[i] = interpolate(colors[k], colors[k + 1], f);
+			else
+				m.color[i] = interpolate(colors[3], colors[0], f);
+			m.roughness[i] = r[i] * 0.3f + 0.4f;
+			m.metallic[i] = 0.02;
+		}
+		recolor(n.recolor, span, 1.1f, 0.1, m);
 	}
 
-	void baseWhite(const Vec3 &pos, Vec3 &color, Real &roughness, Real &metallic)
+	void baseWhite(const TerrainMaterialNoises &n, const Span &span, MaterialSpan &m)
 	{
 		// https://www.pinterest.com/pin/432908582921844576/
 
@@ -187,60 +585,88 @@ namespace
 			pdnToRgb(217, 9, 74)
 		};
 
-		static Holder<NoiseFunction> clouds1 = newClouds(3);
-		static Holder<NoiseFunction> clouds2 = newClouds(3);
-		static Holder<NoiseFunction> clouds3 = newClouds(3);
-		static Holder<NoiseFunction> clouds4 = newClouds(3);
-		static Holder<NoiseFunction> value1 = newValue();
-
-		Vec3 off = Vec3(evaluateClamp(clouds1, pos * 0.1), evaluateClamp(clouds2, pos * 0.1), evaluateClamp(clouds3, pos * 0.1));
-		Real n = evaluateClamp(value1, pos * 0.1 + off);
-		color = ninterpolate<3>(colors, n);
-		color = recolor(color, 0.2, pos * 0.72);
-		color = recolor(color, 0.13, pos * 1.3);
-		roughness = pow(evaluateClamp(clouds4, pos * 1.441), 0.5) * 0.7 + 0.01;
-		metallic = 0.05;
+		const WhiteNoises &d = n.white;
+		float ox[SpanSize], oy[SpanSize], oz[SpanSize], v[SpanSize], r[SpanSize];
+		evaluateSpan(d.clouds1, 0.1f, span, ox);
+		evaluateSpan(d.clouds2, 0.1f, span, oy);
+		evaluateSpan(d.clouds3, 0.1f, span, oz);
+		Span p;
+		displaceSpan(span, 0.1f, ox, oy, oz, 1, p);
+		evaluateSpan(d.value1, 1, p, v);
+		evaluateSpan(d.clouds4, 1.441f, span, r);
+		for (uint32 i = 0; i < span.count; i++)
+		{
+			m.color[i] = ninterpolate<3>(colors, v[i]);
+			m.roughness[i] = noise::pow(r[i], 0.5f) * 0.7f + 0.01f;
+			m.metallic[i] = 0.05;
+		}
+		recolor(n.recolor, span, 0.72f, 0.2, m);
+		recolor(n.recolor, span, 1.3f, 0.13, m);
 	}
 
-	void baseDarkRock1(const Vec3 &pos, Vec3 &color, Real &roughness, Real &metallic)
+	void baseDarkRock1(const TerrainMaterialNoises &n, const LowFrequencyFields *low, const Span &span, MaterialSpan &m)
 	{
 		// https://www.goodfreephotos.com/united-states/colorado/other-colorado/rock-cliff-in-the-fog-in-colorado.jpg.php
 
-		static Holder<NoiseFunction> clouds1 = newClouds(3);
-		static Holder<NoiseFunction> clouds2 = newClouds(3);
-		static Holder<NoiseFunction> clouds3 = newClouds(3);
-		static Holder<NoiseFunction> clouds4 = newClouds(3);
-		static Holder<NoiseFunction> clouds5 = newClouds(3);
-		static Holder<NoiseFunction> cell1 = newCell(NoiseOperationEnum::Subtract);
-		static Holder<NoiseFunction> value1 = newValue();
-
-		Vec3 off = Vec3(evaluateClamp(clouds1, pos * 0.043), evaluateClamp(clouds2, pos * 0.043), evaluateClamp(clouds3, pos * 0.043));
-		Real f = evaluateClamp(cell1, pos * 0.0147 + off * 0.23);
-		Real m = evaluateClamp(clouds4, pos * 0.018);
-		if (f < 0.017 && m < 0.35)
-		{ // the vein
-			static const Vec3 vein[2] = {
-				pdnToRgb(18, 18, 60),
-				pdnToRgb(21, 22, 49)
-			};
+		static const Vec3 vein[2] = {
+			pdnToRgb(18, 18, 60),
+			pdnToRgb(21, 22, 49)
+		};
+
+		static const Vec3 colors[3] = {
+			pdnToRgb(240, 1, 45),
+			pdnToRgb(230, 5, 41),
+			pdnToRgb(220, 25, 27)
+		};
 
-			color = interpolate(vein[0], vein[1], evaluateClamp(value1, pos));
-			roughness = evaluateClamp(clouds5, pos * 0.718) * 0.3 + 0.3;
-			metallic = 0.6;
+		const DarkRock1Noises &d = n.darkRock1;
+		bool isVein[SpanSize];
+		{
+			float ox[SpanSize], oy[SpanSize], oz[SpanSize], f[SpanSize], mask[SpanSize];
+			evaluateSpan(d.clouds1, 0.043f, span, ox);
+			evaluateSpan(d.clouds2, 0.043f, span, oy);
+			evaluateSpan(d.clouds3, 0.043f, span, oz);
+			Span p;
+			displaceSpan(span, 0.0147f, ox, oy, oz, 0.23f, p);
+			evaluateSpan(d.cell1, 1, p, f);
+			evaluateSpan(low ? &low->veins : nullptr, d.clouds4, 0.018f, span, mask);
+			for (uint32 i = 0; i < span.count; i++)
+				isVein[i] = f[i] < 0.017f && mask[i] < 0.35f;
+		}
+		Span p;
+		uint32 indices[SpanSize];
+		MaterialSpan tmp;
+
+		{ // the vein
+			compactSpan(span, isVein, p, indices);
+			float v[SpanSize], r[SpanSize];
+			evaluateSpan(d.value1, 1, p, v);
+			evaluateSpan(d.clouds5, 0.718f, p, r);
+			for (uint32 i = 0; i < p.count; i++)
+			{
+				const uint32 k = indices[i];
+				m.color[k] = interpolate(vein[0], vein[1], v[i]);
+				m.roughness[k] = r[i] * 0.3f + 0.3f;
+				m.metallic[k] = 0.6;
+			}
 		}
-		else
-		{ // the rocks
-			static const Vec3 colors[3] = {
-				pdnToRgb(240, 1, 45),
-				pdnToRgb(230, 5, 41),
-				pdnToRgb(220, 25, 27)
-			};
 
-			darkRockGeneral(pos, color, roughness, metallic, colors, sizeof(colors) / sizeof(colors[0]));
+		{ // the rocks
+			for (uint32 i = 0; i < span.count; i++)
+				isVein[i] = !isVein[i];
+			compactSpan(span, isVein, p, indices);
+			darkRockGeneral(n, p, tmp, colors);
+			for (uint32 i = 0; i < p.count; i++)
+			{
+				const uint32 k = indices[i];
+				m.color[k] = tmp.color[i];
+				m.roughness[k] = tmp.roughness[i];
+				m.metallic[k] = tmp.metallic[i];
+			}
 		}
 	}
 
-	void baseDarkRock2(const Vec3 &pos, Vec3 &color, Real &roughness, Real &metallic)
+	void baseDarkRock2(const TerrainMaterialNoises &n, const Span &span, MaterialSpan &m)
 	{
 		// https://www.schemecolor.com/rocky-cliff-color-scheme.php
 
@@ -251,241 +677,493 @@ namespace
 			pdnToRgb(232, 27, 21)
 		};
 
-		darkRockGeneral(pos, color, roughness, metallic, colors, sizeof(colors) / sizeof(colors[0]));
+		darkRockGeneral(n, span, m, colors);
 	}
 
-	void basesSwitch(uint32 baseIndex, const Vec3 &pos, Vec3 &color, Real &roughness, Real &metallic)
+	void basesSwitch(uint32 baseIndex, const TerrainMaterialNoises &n, const LowFrequencyFields *low, const Span &span, MaterialSpan &m)
 	{
 		switch (baseIndex)
 		{
-		case 0: basePaper(pos, color, roughness, metallic); break;
-		case 1: baseSphinx(pos, color, roughness, metallic); break;
-		case 2: baseWhite(pos, color, roughness, metallic); break;
-		case 3: baseDarkRock1(pos, color, roughness, metallic); break;
-		case 4: baseDarkRock2(pos, color, roughness, metallic); break;
+		case 0: basePaper(n, span, m); break;
+		case 1: baseSphinx(n, low, span, m); break;
+		case 2: baseWhite(n, span, m); break;
+		case 3: baseDarkRock1(n, low, span, m); break;
+		case 4: baseDarkRock2(n, span, m); break;
 		default: CAGE_THROW_CRITICAL(NotImplemented, "unknown terrain base color enum");
 		}
 	}
 
-	std::array<Real, 5> basesWeights(const Vec3 &pos)
-	{
-		static Holder<NoiseFunction> clouds1 = newClouds(3);
-		static Holder<NoiseFunction> clouds2 = newClouds(3);
-		static Holder<NoiseFunction> clouds3 = newClouds(3);
-		static Holder<NoiseFunction> clouds4 = newClouds(3);
-		static Holder<NoiseFunction> clouds5 = newClouds(3);
-
-		const Vec3 p = pos * 0.01;
-		std::array<Real, 5> result;
-		result[0] = clouds1->evaluate(p);
-		result[1] = clouds2->evaluate(p);
-		result[2] = clouds3->evaluate(p);
-		result[3] = clouds4->evaluate(p);
-		result[4] = clouds5->evaluate(p);
-		return result;
+	// the two strongest bases are blended, only their relative weights matter
+	void basesWeightsSpan(const TerrainMaterialNoises &n, const LowFrequencyFields *low, const Span &span, uint32 *first, uint32 *second, Real *blend)
+	{
+		float weights[5][SpanSize];
+		for (uint32 b = 0; b < 5; b++)
+			evaluateSpan(low ? &low->weights[b] : nullptr, n.weights[b], 0.01f, span, weights[b]);
+		for (uint32 i = 0; i < span.count; i++)
+		{
+			uint32 a = 0, b = 1;
+			if (weights[b][i] > weights[a][i])
+				std::swap(a, b);
+			for (uint32 k = 2; k < 5; k++)
+			{
+				if (weights[k][i] > weights[a][i])
+				{
+					b = a;
+					a = k;
+				}
+				else if (weights[k][i] > weights[b][i])
+					b = k;
+			}
+			first[i] = a;
+			second[i] = b;
+			Vec2 w2 = normalize(Vec2(weights[a][i], weights[b][i]));
+			CAGE_ASSERT(w2[0] >= w2[1]);
+			Real d = w2[0] - w2[1];
+			blend[i] = clamp(rerange(d, 0, 0.1, 0.5, 0), 0, 0.5);
+		}
 	}
 
-	struct WeightIndex
+	// slope is the derivative of the terrain height along the y axis, it is not needed when rockOnly
+	// low is optional
+	void terrainMaterialSpan(const TerrainMaterialNoises &n, const LowFrequencyFields *low, const Span &span, const float *slope, MaterialSpan &m, bool rockOnly)
 	{
-		Real weight;
-		uint32 index = m;
-	};
+		const uint32 cnt = span.count;
+		Span p;
+		uint32 indices[SpanSize];
+		bool mask[SpanSize];
 
-	Real slab(Real v)
-	{
-		v = v % 1;
-		if (v > 0.8)
-			return sin(Rads::Full() * 0.5 * (v - 0.8) / 0.2 + Rads::Full() * 0.25);
-		return v / 0.8;
-	}
-}
+		{ // base
+			uint32 first[SpanSize], second[SpanSize];
+			Real blend[SpanSize];
+			basesWeightsSpan(n, low, span, first, second, blend);
+			MaterialSpan c[2], tmp;
+			for (uint32 b = 0; b < 5; b++)
+			{
+				for (uint32 i = 0; i < cnt; i++)
+					mask[i] = first[i] == b || second[i] == b;
+				compactSpan(span, mask, p, indices);
+				if (p.count == 0)
+					continue;
+				basesSwitch(b, n, low, p, tmp);
+				for (uint32 i = 0; i < p.count; i++)
+				{
+					const uint32 k = indices[i];
+					const uint32 slot = first[k] == b ? 0 : 1;
+					c[slot].color[k] = tmp.color[i];
+					c[slot].roughness[k] = tmp.roughness[i];
+					c[slot].metallic[k] = tmp.metallic[i];
+				}
+			}
+			for (uint32 i = 0; i < cnt; i++)
+			{
+				m.color[i] = interpolate(c[0].color[i], c[1].color[i], blend[i]);
+				m.roughness[i] = interpolate(c[0].roughness[i], c[1].roughness[i], blend[i]);
+				m.metallic[i] = interpolate(c[0].metallic[i], c[1].metallic[i], blend[i]);
+			}
+		}
 
-Real terrainOffset(const Vec2 &pos)
-{
-	static Holder<NoiseFunction> clouds1 = newClouds(3);
-	static Holder<NoiseFunction> clouds2 = newClouds(3);
-	static Holder<NoiseFunction> clouds3 = newClouds(3);
-	static Holder<NoiseFunction> clouds4 = newClouds(3);
-	static Holder<NoiseFunction> clouds5 = newClouds(3);
-	static Holder<NoiseFunction> clouds6 = newClouds(3);
-	static Holder<NoiseFunction> clouds7 = newClouds(3);
-	static Holder<NoiseFunction> clouds8 = newClouds(3);
-	static Holder<NoiseFunction> clouds9 = newClouds(3);
-	static Holder<NoiseFunction> clouds10 = newClouds(3);
-	static Holder<NoiseFunction> cell1 = newCell();
-	static Holder<NoiseFunction> cell2 = newCell(NoiseOperationEnum::Subtract);
-
-	Real result;
-
-	{ // slope
-		result -= pos[1] * 0.2;
-	}
+		{ // small cracks
+			float mk[SpanSize], f[SpanSize];
+			evaluateSpan(n.clouds1, 0.43f, span, mk);
+			for (uint32 i = 0; i < cnt; i++)
+				mask[i] = mk[i] < 0.5f;
+			compactSpan(span, mask, p, indices);
+			evaluateSpan(n.cell1, 0.187f, p, f);
+			for (uint32 i = 0; i < p.count; i++)
+			{
+				if (f[i] < 0.02f)
+				{
+					const uint32 k = indices[i];
+					m.color[k] *= 0.6;
+					m.roughness[k] *= 1.2;
+				}
+			}
+		}
 
-	{ // horizontal slabs
-		Real off = evaluateClamp(clouds1, pos * 0.0065);
-		Real mask = evaluateClamp(clouds2, pos * 0.00715);
-		result += slab(pos[1] * 0.027 + off * 2.5) * sharpEdge(mask * 2 - 0.7) * 5;
-	}
+		{ // white glistering spots
+			float f[SpanSize];
+			evaluateSpan(n.cell2, 0.084f, span, f);
+			for (uint32 i = 0; i < cnt; i++)
+			{
+				if (f[i] > 0.95f)
+				{
+					Real c = noise::evaluateClamp(n.clouds2, span.x[i] * 3, span.y[i] * 3, span.z[i] * 3) * 0.2f + 0.8f;
+					m.color[i] = Vec3(c);
+					m.roughness[i] = 0.2;
+					m.metallic[i] = 0.4;
+				}
+			}
+		}
 
-	{ // extra saliences
-		Real a = evaluateClamp(cell1, pos * 0.0241);
-		Real b = evaluateOrig(clouds3, pos * 0.041);
-		result += sharpEdge(a + b - 0.4);
-	}
+		if (rockOnly)
+			return;
 
-	{ // medium-frequency waves
-		Real scl = evaluateClamp(clouds4, pos * 0.00921);
-		Real rot = evaluateClamp(clouds5, pos * 0.00398);
-		Vec2 off = Vec2(rot + 0.5, 1.5 - rot);
-		Real mask = evaluateClamp(clouds6, pos * 0.00654);
-		Real a = evaluateClamp(cell2, (pos * 0.01 + off) * (scl + 0.5));
-		result += pow((min(a + 0.95, 1) - 0.95) * 20, 3) * sharpEdge(mask - 0.1) * 0.5;
-	}
+		{ // large cracks
+			float mk[SpanSize], ox[SpanSize], oy[SpanSize], oz[SpanSize], f[SpanSize];
+			evaluateSpan(low ? &low->largeCracks : nullptr, n.clouds3, 0.023f, span, mk);
+			for (uint32 i = 0; i < cnt; i++)
+				mask[i] = mk[i] < 0.4f;
+			compactSpan(span, mask, p, indices);
+			evaluateSpan(n.cell3, 0.1f, p, ox);
+			evaluateSpan(n.cell4, 0.1f, p, oy);
+			evaluateSpan(n.cell5, 0.1f, p, oz);
+			Span q;
+			displaceSpan(p, 0.034f, ox, oy, oz, 0.23f, q);
+			evaluateSpan(n.cell6, 1, q, f);
+			for (uint32 i = 0; i < p.count; i++)
+			{
+				if (f[i] < 0.015f)
+				{
+					const uint32 k = indices[i];
+					m.color[k] *= 0.3;
+					m.roughness[k] *= 1.5;
+				}
+			}
+		}
 
-	{ // high-frequency x-aligned cracks
-		Real a = pow(evaluateClamp(clouds7, pos * Vec2(0.036, 0.13)), 0.2);
-		Real b = pow(evaluateClamp(clouds8, pos * Vec2(0.047, 0.029)), 0.1);
-		result += min(a, b) * 3;
+		{ // large grass (on up facing surfaces)
+			// positive -> up facing
+			// negative -> down facing
+			float thr[SpanSize];
+			evaluateSpan(low ? &low->grass : nullptr, n.clouds4, 0.015f, span, thr);
+			for (uint32 i = 0; i < cnt; i++)
+				mask[i] = -slope[i] > thr[i] + 0.2f;
+			compactSpan(span, mask, p, indices);
+			float mk[SpanSize], h[SpanSize], s[SpanSize], v[SpanSize], r[SpanSize];
+			evaluateSpan(n.clouds5, 2.423f, p, mk);
+			evaluateSpan(n.value1, 1, p, h);
+			evaluateSpan(n.value2, 1, p, s);
+			evaluateSpan(n.value3, 1, p, v);
+			evaluateSpan(n.clouds6, 1.23f, p, r);
+			for (uint32 i = 0; i < p.count; i++)
+			{
+				const uint32 k = indices[i];
+				Real f = sharpEdge(mk[i]);
+				Vec3 grass = colorHsvToRgb(Vec3(h[i] * 0.3f + 0.13f, s[i] * 0.2f + 0.5f, v[i] * 0.2f + 0.5f));
+				m.color[k] = interpolate(m.color[k], grass, f);
+				m.roughness[k] = interpolate(m.roughness[k], r[i] * 0.4f + 0.2f, f);
+				m.metallic[k] = interpolate(m.metallic[k], 0.01, f);
+			}
+		}
 	}
 
-	{ // medium-frequency y-aligned cracks
-		Real a = pow(evaluateClamp(clouds9, pos * Vec2(0.11, 0.027) * 0.5), 0.2);
-		Real b = pow(evaluateClamp(clouds10, pos * Vec2(0.033, 0.051) * 0.5), 0.1);
-		result += min(a, b) * 3;
-	}
+	class TerrainGeneratorImpl : public TerrainGenerator
+	{
+	public:
+		SeedSequence seeds;
+		const TerrainOffsetNoises offsetNoises = { { seeds.next() } };
+		const TerrainMaterialNoises materialNoises = { { seeds.next() } };
 
-	CAGE_ASSERT(result.valid());
-	return result;
-}
+		explicit TerrainGeneratorImpl(uint32 seed) : seeds{ seed }
+		{}
 
-void terrainMaterial(const Vec2 &pos2, Vec3 &color, Real &roughness, Real &metallic, bool rockOnly)
-{
-	static Holder<NoiseFunction> clouds1 = newClouds(3);
-	static Holder<NoiseFunction> clouds2 = newClouds(2);
-	static Holder<NoiseFunction> clouds3 = newClouds(3);
-	static Holder<NoiseFunction> clouds4 = newClouds(3);
-	static Holder<NoiseFunction> clouds5 = newClouds(3);
-	static Holder<NoiseFunction> clouds6 = newClouds(3);
-	static Holder<NoiseFunction> cell1 = newCell(NoiseOperationEnum::Subtract);
-	static Holder<NoiseFunction> cell2 = newCell();
-	static Holder<NoiseFunction> cell3 = newCell(NoiseOperationEnum::Distance2, NoiseDistanceEnum::Euclidean);
-	static Holder<NoiseFunction> cell4 = newCell(NoiseOperationEnum::Distance2, NoiseDistanceEnum::Euclidean);
-	static Holder<NoiseFunction> cell5 = newCell(NoiseOperationEnum::Distance2, NoiseDistanceEnum::Euclidean);
-	static Holder<NoiseFunction> cell6 = newCell(NoiseOperationEnum::Subtract);
-	static Holder<NoiseFunction> value1 = newValue();
-	static Holder<NoiseFunction> value2 = newValue();
-	static Holder<NoiseFunction> value3 = newValue();
-
-	Vec3 pos = Vec3(pos2, terrainOffset(pos2));
-
-	{ // base
-		std::array<Real, 5> weights5 = basesWeights(pos);
-		std::array<WeightIndex, 5> indices5;
-		for (uint32 i = 0; i < 5; i++)
+		Real offset(const Vec2 &pos) const
 		{
-			indices5[i].index = i;
-			indices5[i].weight = weights5[i] + 1;
-		}
-		std::sort(std::begin(indices5), std::end(indices5), [](const WeightIndex &a, const WeightIndex &b) {
-			return a.weight > b.weight;
-		});
-		{ // normalize
-			Real l;
-			for (uint32 i = 0; i < 5; i++)
-				l += sqr(indices5[i].weight);
-			l = 1 / sqrt(l);
-			for (uint32 i = 0; i < 5; i++)
-				indices5[i].weight *= l;
-		}
-		Vec2 w2 = normalize(Vec2(indices5[0].weight, indices5[1].weight));
-		CAGE_ASSERT(w2[0] >= w2[1]);
-		Real d = w2[0] - w2[1];
-		Real f = clamp(rerange(d, 0, 0.1, 0.5, 0), 0, 0.5);
-		Vec3 c[2]; Real r[2]; Real m[2];
-		for (uint32 i = 0; i < 2; i++)
-			basesSwitch(indices5[i].index, pos, c[i], r[i], m[i]);
-		color = interpolate(c[0], c[1], f);
-		roughness = interpolate(r[0], r[1], f);
-		metallic = interpolate(m[0], m[1], f);
-	}
+			const Real result = terrainOffsetKernel(offsetNoises, pos[0].value, pos[1].value);
+			CAGE_ASSERT(result.valid());
+			return result;
+		}
 
-	{ // small cracks
-		Real f = evaluateClamp(cell1, pos * 0.187);
-		Real m = evaluateClamp(clouds1, pos * 0.43);
-		if (f < 0.02 && m < 0.5)
+		void offset(PointerRange<const Vec2> positions, PointerRange<Real> results) const
 		{
-			color *= 0.6;
-			roughness *= 1.2;
+			CAGE_ASSERT(positions.size() == results.size());
+			float x[SpanSize], y[SpanSize], z[SpanSize];
+			for (uint32 offset = 0; offset < positions.size(); offset += SpanSize)
+			{
+				const uint32 cnt = min(numeric_cast<uint32>(positions.size()) - offset, SpanSize);
+				for (uint32 i = 0; i < cnt; i++)
+				{
+					x[i] = positions[offset + i][0].value;
+					y[i] = positions[offset + i][1].value;
+				}
+				terrainOffsetSpan(offsetNoises, x, y, z, cnt);
+				for (uint32 i = 0; i < cnt; i++)
+					results[offset + i] = z[i];
+			}
 		}
-	}
 
-	{ // white glistering spots
-		if (evaluateClamp(cell2, pos * 0.084) > 0.95)
+		Real offset(const Vec2 &pos, Vec2 &gradient) const
 		{
-			Real c = evaluateClamp(clouds2, pos * 3) * 0.2 + 0.8;
-			color = Vec3(c);
-			roughness = 0.2;
-			metallic = 0.4;
+			const noise::Grad2 result = terrainOffsetKernel(offsetNoises, noise::Grad2{ pos[0].value, 1, 0 }, noise::Grad2{ pos[1].value, 0, 1 });
+			gradient = Vec2(result.dx, result.dy);
+			CAGE_ASSERT(gradient.valid());
+			return result.v;
 		}
-	}
 
-	if (rockOnly)
-		return;
+		void offset(PointerRange<const Vec2> positions, PointerRange<Real> results, PointerRange<Vec2> gradients) const
+		{
+			CAGE_ASSERT(positions.size() == results.size());
+			CAGE_ASSERT(positions.size() == gradients.size());
+			float x[SpanSize], y[SpanSize], z[SpanSize], dx[SpanSize], dy[SpanSize];
+			for (uint32 offset = 0; offset < positions.size(); offset += SpanSize)
+			{
+				const uint32 cnt = min(numeric_cast<uint32>(positions.size()) - offset, SpanSize);
+				for (uint32 i = 0; i < cnt; i++)
+				{
+					x[i] = positions[offset + i][0].value;
+					y[i] = positions[offset + i][1].value;
+				}
+				terrainOffsetSpan(offsetNoises, x, y, z, dx, dy, cnt);
+				for (uint32 i = 0; i < cnt; i++)
+				{
+					results[offset + i] = z[i];
+					gradients[offset + i] = Vec2(dx[i], dy[i]);
+				}
+			}
+		}
 
-	{ // large cracks
-		Vec3 off = Vec3(evaluateClamp(cell3, pos * 0.1), evaluateClamp(cell4, pos * 0.1), evaluateClamp(cell5, pos * 0.1));
-		Real f = evaluateClamp(cell6, pos * 0.034 + off * 0.23);
-		Real m = evaluateClamp(clouds3, pos * 0.023);
-		if (f < 0.015 && m < 0.4)
+		void material(const Vec2 &pos, Vec3 &color, Real &roughness, Real &metallic, bool rockOnly) const
 		{
-			color *= 0.3;
-			roughness *= 1.5;
+			material({ &pos, &pos + 1 }, { &color, &color + 1 }, { &roughness, &roughness + 1 }, { &metallic, &metallic + 1 }, rockOnly, 0);
+		}
+
+		// heights of the positions, their slopes unless the slopes are empty, and their bounding box
+		void heightsAndBounds(PointerRange<const Vec2> positions, std::vector<float> &heights, std::vector<float> &slopes, float lo[3], float hi[3]) const
+		{
+			const uint32 total = numeric_cast<uint32>(positions.size());
+			constexpr float inf = std::numeric_limits<float>::infinity();
+			for (uint32 a = 0; a < 3; a++)
+			{
+				lo[a] = inf;
+				hi[a] = -inf;
+			}
+			Span span;
+			float dx[SpanSize];
+			for (uint32 offset = 0; offset < total; offset += SpanSize)
+			{
+				span.count = min(total - offset, SpanSize);
+				for (uint32 i = 0; i < span.count; i++)
+				{
+					span.x[i] = positions[offset + i][0].value;
+					span.y[i] = positions[offset + i][1].value;
+				}
+				if (slopes.empty())
+					terrainOffsetSpan(offsetNoises, span.x, span.y, heights.data() + offset, span.count);
+				else
+					terrainOffsetSpan(offsetNoises, span.x, span.y, heights.data() + offset, dx, slopes.data() + offset, span.count);
+				for (uint32 i = 0; i < span.count; i++)
+				{
+					const float p[3] = { span.x[i], span.y[i], heights[offset + i] };
+					for (uint32 a = 0; a < 3; a++)
+					{
+						lo[a] = noise::min(lo[a], p[a]);
+						hi[a] = noise::max(hi[a], p[a]);
+					}
+				}
+			}
+		}
+
+		void material(PointerRange<const Vec2> positions, PointerRange<Vec3> colors, PointerRange<Real> roughness, PointerRange<Real> metallic, bool rockOnly, Real tolerance) const
+		{
+			CAGE_ASSERT(positions.size() == colors.size());
+			CAGE_ASSERT(positions.size() == roughness.size());
+			CAGE_ASSERT(positions.size() == metallic.size());
+			CAGE_ASSERT(tolerance >= 0);
+			const uint32 total = numeric_cast<uint32>(positions.size());
+			std::vector<float> heights(total), slopes(rockOnly ? 0 : total);
+			float lo[3], hi[3];
+			heightsAndBounds(positions, heights, slopes, lo, hi);
+			Span span;
+
+			LowFrequencyFields fields;
+			const bool useFields = tolerance > 0 && total > 0;
+			if (useFields)
+				fields.build(materialNoises, lo, hi, tolerance.value, rockOnly, total);
+
+			MaterialSpan m;
+			for (uint32 offset = 0; offset < total; offset += SpanSize)
+			{
+				span.count = min(total - offset, SpanSize);
+				for (uint32 i = 0; i < span.count; i++)
+				{
+					span.x[i] = positions[offset + i][0].value;
+					span.y[i] = positions[offset + i][1].value;
+					span.z[i] = heights[offset + i];
+				}
+				terrainMaterialSpan(materialNoises, useFields ? &fields : nullptr, span, rockOnly ? nullptr : slopes.data() + offset, m, rockOnly);
+				for (uint32 i = 0; i < span.count; i++)
+				{
+					colors[offset + i] = m.color[i];
+					roughness[offset + i] = m.roughness[i];
+					metallic[offset + i] = m.metallic[i];
+				}
+			}
 		}
-	}
 
-	// positive -> up facing
-	// negative -> down facing
-	Real vn = (terrainOffset(pos2 + Vec2(0, -0.1)) - terrainOffset(pos2)) / 0.1;
+		Real coarseFieldsError(PointerRange<const Vec2> positions, Real tolerance, uint32 &fieldsCount) const
+		{
+			CAGE_ASSERT(tolerance > 0);
+			const uint32 total = numeric_cast<uint32>(positions.size());
+			std::vector<float> heights(total), slopes;
+			float lo[3], hi[3];
+			heightsAndBounds(positions, heights, slopes, lo, hi);
+			LowFrequencyFields fields;
+			fields.build(materialNoises, lo, hi, tolerance.value, false, total);
+			fieldsCount = 0;
+			float result = 0;
+			fields.each(materialNoises, false, [&](CoarseField &field, const auto &noise, float frequency) {
+				if (field.values.empty())
+					return;
+				fieldsCount++;
+				Span span;
+				float coarse[SpanSize], exact[SpanSize];
+				for (uint32 offset = 0; offset < total; offset += SpanSize)
+				{
+					span.count = min(total - offset, SpanSize);
+					for (uint32 i = 0; i < span.count; i++)
+					{
+						span.x[i] = positions[offset + i][0].value;
+						span.y[i] = positions[offset + i][1].value;
+						span.z[i] = heights[offset + i];
+					}
+					field.evaluate(span, coarse);
+					evaluateSpan(noise, frequency, span, exact);
+					for (uint32 i = 0; i < span.count; i++)
+						result = noise::max(result, std::abs(coarse[i] - exact[i]));
+				}
+			});
+			return result;
+		}
 
-	{ // large grass (on up facing surfaces)
-		Real thr = evaluateClamp(clouds4, pos * 0.015);
-		if (vn > thr + 0.2)
+		void layer(TerrainLayerEnum layer, PointerRange<const Vec2> positions, PointerRange<Vec3> colors, PointerRange<Real> roughness, PointerRange<Real> metallic) const
 		{
-			Real mask = evaluateClamp(clouds5, pos * 2.423);
-			Real m = sharpEdge(mask);
-			Vec3 grass = colorHsvToRgb(Vec3(
-				evaluateClamp(value1, pos) * 0.3 + 0.13,
-				evaluateClamp(value2, pos) * 0.2 + 0.5,
-				evaluateClamp(value3, pos) * 0.2 + 0.5
-			));
-			Real r = evaluateClamp(clouds6, pos * 1.23) * 0.4 + 0.2;
-			color = interpolate(color, grass, m);
-			roughness = interpolate(roughness, r, m);
-			metallic = interpolate(metallic, 0.01, m);
+			CAGE_ASSERT(positions.size() == colors.size());
+			CAGE_ASSERT(positions.size() == roughness.size());
+			CAGE_ASSERT(positions.size() == metallic.size());
+			const uint32 total = numeric_cast<uint32>(positions.size());
+			Span span;
+			MaterialSpan m;
+			for (uint32 offset = 0; offset < total; offset += SpanSize)
+			{
+				span.count = min(total - offset, SpanSize);
+				for (uint32 i = 0; i < span.count; i++)
+				{
+					span.x[i] = positions[offset + i][0].value;
+					span.y[i] = positions[offset + i][1].value;
+				}
+				terrainOffsetSpan(offsetNoises, span.x, span.y, span.z, span.count);
+				if (layer == TerrainLayerEnum::BasesWeights)
+				{
+					uint32 first[SpanSize], second[SpanSize];
+					Real blend[SpanSize];
+					basesWeightsSpan(materialNoises, nullptr, span, first, second, blend);
+					for (uint32 i = 0; i < span.count; i++)
+					{
+						m.color[i] = Vec3(first[i], second[i], blend[i]);
+						m.roughness[i] = 0;
+						m.metallic[i] = 0;
+					}
+				}
+				else
+					basesSwitch((uint32)layer - (uint32)TerrainLayerEnum::BasePaper, materialNoises, nullptr, span, m);
+				for (uint32 i = 0; i < span.count; i++)
+				{
+					colors[offset + i] = m.color[i];
+					roughness[offset + i] = m.roughness[i];
+					metallic[offset + i] = m.metallic[i];
+				}
+			}
 		}
+	};
+
+	// the terrain of the game uses a random seed
+	const TerrainGenerator *gameTerrain()
+	{
+		static const Holder<TerrainGenerator> generator = newTerrainGenerator((uint32)detail::randomGenerator().next());
+		return +generator;
 	}
 }
 
-Quat sunLightOrientation(const Vec2 &playerPosition)
+const noise::CellOffsets &noise::cellOffsets()
 {
-	return Quat(Degs(-50), Degs(sin(Degs(playerPosition[0] * 0.2 + 40)) * 70), Degs());
+	static const CellOffsets offsets = recoverCellOffsets();
+	return offsets;
 }
 
-namespace
+Real TerrainGenerator::offset(const Vec2 &position) const
 {
-	class Initializer
-	{
-	public:
-		Initializer()
-		{
-			// ensure consistent order of initialization of all the static noise functions
-			Vec2 p2;
-			Vec3 p3, c;
-			Real r, m;
-			for (uint32 i = 0; i < 5; i++)
-				basesSwitch(i, p3, c, r, m);
-			terrainOffset(p2);
-			terrainMaterial(p2, c, r, m, false);
-		}
-	} initializer;
+	const TerrainGeneratorImpl *impl = (const TerrainGeneratorImpl *)this;
+	return impl->offset(position);
+}
+
+Real TerrainGenerator::offset(const Vec2 &position, Vec2 &gradient) const
+{
+	const TerrainGeneratorImpl *impl = (const TerrainGeneratorImpl *)this;
+	return impl->offset(position, gradient);
+}
+
+void TerrainGenerator::offset(PointerRange<const Vec2> positions, PointerRange<Real> results) const
+{
+	const TerrainGeneratorImpl *impl = (const TerrainGeneratorImpl *)this;
+	impl->offset(positions, results);
+}
+
+void TerrainGenerator::offset(PointerRange<const Vec2> positions, PointerRange<Real> results, PointerRange<Vec2> gradients) const
+{
+	const TerrainGeneratorImpl *impl = (const TerrainGeneratorImpl *)this;
+	impl->offset(positions, results, gradients);
+}
+
+void TerrainGenerator::material(const Vec2 &position, Vec3 &color, Real &roughness, Real &metallic, bool rockOnly) const
+{
+	const TerrainGeneratorImpl *impl = (const TerrainGeneratorImpl *)this;
+	impl->material(position, color, roughness, metallic, rockOnly);
+}
+
+void TerrainGenerator::material(PointerRange<const Vec2> positions, PointerRange<Vec3> colors, PointerRange<Real> roughness, PointerRange<Real> metallic, bool rockOnly, Real tolerance) const
+{
+	const TerrainGeneratorImpl *impl = (const TerrainGeneratorImpl *)this;
+	impl->material(positions, colors, roughness, metallic, rockOnly, tolerance);
+}
+
+Real TerrainGenerator::coarseFieldsError(PointerRange<const Vec2> positions, Real tolerance, uint32 &fieldsCount) const
+{
+	const TerrainGeneratorImpl *impl = (const TerrainGeneratorImpl *)this;
+	return impl->coarseFieldsError(positions, tolerance, fieldsCount);
+}
+
+void TerrainGenerator::layer(TerrainLayerEnum layer, PointerRange<const Vec2> positions, PointerRange<Vec3> colors, PointerRange<Real> roughness, PointerRange<Real> metallic) const
+{
+	const TerrainGeneratorImpl *impl = (const TerrainGeneratorImpl *)this;
+	impl->layer(layer, positions, colors, roughness, metallic);
+}
+
+Holder<TerrainGenerator> newTerrainGenerator(uint32 seed)
+{
+	return systemMemory().createImpl<TerrainGenerator, TerrainGeneratorImpl>(seed);
+}
+
+Real terrainOffset(const Vec2 &position)
+{
+	return gameTerrain()->offset(position);
+}
+
+void terrainOffset(PointerRange<const Vec2> positions, PointerRange<Real> results)
+{
+	gameTerrain()->offset(positions, results);
+}
+
+Real terrainOffset(const Vec2 &position, Vec2 &gradient)
+{
+	return gameTerrain()->offset(position, gradient);
+}
+
+void terrainOffset(PointerRange<const Vec2> positions, PointerRange<Real> results, PointerRange<Vec2> gradients)
+{
+	gameTerrain()->offset(positions, results, gradients);
+}
+
+void terrainMaterial(const Vec2 &position, Vec3 &color, Real &roughness, Real &metallic, bool rockOnly)
+{
+	gameTerrain()->material(position, color, roughness, metallic, rockOnly);
+}
+
+void terrainMaterial(PointerRange<const Vec2> positions, PointerRange<Vec3> colors, PointerRange<Real> roughness, PointerRange<Real> metallic, bool rockOnly, Real tolerance)
+{
+	gameTerrain()->material(positions, colors, roughness, metallic, rockOnly, tolerance);
+}
+
+Quat sunLightOrientation(const Vec2 &playerPosition)
+{
+	return Quat(Degs(-50), Degs(sin(Degs(playerPosition[0] * 0.2 + 40)) * 70), Degs());
 }
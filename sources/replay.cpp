@@ -0,0 +1,243 @@
+#include "common.h"
+
+#include <cage-core/files.h>
+#include <cage-core/memoryBuffer.h>
+#include <cage-core/serialization.h>
+#include <cage-core/random.h>
+
+#include <cage-engine/window.h>
+#include <cage-simple/engine.h>
+
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+	constexpr uint32 ReplayVersion = 3;
+	constexpr uint64 ReplayUpdatePeriod = 1; // updates follow each other as fast as possible
+	constexpr uint64 ReplayTilesTimeout = 60000000; // longest wait for the terrain tiles of one update
+
+	struct ReplayFrame
+	{
+		Vec3 cursor; // nan when the cursor is off the terrain
+		bool clinch = false;
+	};
+
+	String recordPath;
+	bool replaying = false;
+	uint64 seed[2] = {};
+	uint64 updatePeriod = 0; // of the recorded session
+	std::vector<ReplayFrame> frames;
+	uint32 currentFrame = 0;
+	std::vector<std::pair<uint32, Vec2i>> tiles; // update index and position of terrain tiles in the order they were registered
+	uint32 currentTile = 0;
+	uint32 currentUpdate = 0; // of the game, held updates are not counted
+	bool holding = false;
+	uint64 holdingStart = 0;
+	uint32 heldUpdates = 0;
+	std::vector<Vec2i> pendingTiles;
+	Vec3 finalPosition = Vec3::Nan(); // of the player
+	bool diverged = false;
+
+	std::vector<uint64> frameTimes, tileLatencies, physicsTimes; // microseconds
+	uint64 lastUpdateTime = 0;
+
+	void report(const String &name, std::vector<uint64> &values)
+	{
+		if (values.empty())
+			return;
+		std::sort(values.begin(), values.end());
+		const auto &percentile = [&](uint32 p) {
+			return values[min((uint64)values.size() - 1, (uint64)values.size() * p / 100)];
+		};
+		CAGE_LOG(SeverityEnum::Info, "replay", Stringizer() + name + ": p50: " + percentile(50) + " us, p90: " + percentile(90) + " us, p99: " + percentile(99) + " us, max: " + values.back() + " us, count: " + values.size());
+	}
+
+	void save()
+	{
+		MemoryBuffer buffer;
+		Serializer ser(buffer);
+		ser << ReplayVersion << seed[0] << seed[1] << updatePeriod << numeric_cast<uint32>(frames.size());
+		for (const ReplayFrame &f : frames)
+			ser << f.cursor << f.clinch;
+		ser << numeric_cast<uint32>(tiles.size());
+		for (const auto &t : tiles)
+			ser << t.first << t.second;
+		ser << playerPosition;
+		writeFile(recordPath)->write(buffer);
+		CAGE_LOG(SeverityEnum::Info, "replay", Stringizer() + "recorded " + frames.size() + " updates to: " + recordPath);
+	}
+
+	void load(const String &path)
+	{
+		const MemoryBuffer buffer = readFile(path)->readAll();
+		Deserializer des(buffer);
+		uint32 version = 0, cnt = 0;
+		des >> version;
+		if (version != ReplayVersion)
+			CAGE_THROW_ERROR(Exception, "incompatible replay file version");
+		des >> seed[0] >> seed[1] >> updatePeriod >> cnt;
+		frames.resize(cnt);
+		for (ReplayFrame &f : frames)
+			des >> f.cursor >> f.clinch;
+		des >> cnt;
+		tiles.resize(cnt);
+		for (auto &t : tiles)
+			des >> t.first >> t.second;
+		des >> finalPosition;
+	}
+
+	// runs before all other listeners, the game skips the whole update while the replay waits for terrain tiles
+	const auto engineHoldListener = controlThread().update.listen([]() {
+		holding = false;
+		if (replaying)
+		{
+			pendingTiles.clear();
+			for (uint32 i = currentTile; i < tiles.size() && tiles[i].first <= currentUpdate + 1; i++)
+				pendingTiles.push_back(tiles[i].second);
+			holding = !terrainTilesGenerated(pendingTiles);
+		}
+		if (holding)
+		{
+			const uint64 now = applicationTime();
+			heldUpdates++;
+			if (holdingStart == 0)
+				holdingStart = now;
+			if (now > holdingStart + ReplayTilesTimeout)
+			{
+				CAGE_LOG(SeverityEnum::Error, "replay", Stringizer() + "replay diverged, terrain tiles of update " + (currentUpdate + 1) + " were not generated in time");
+				diverged = true;
+				engineStop();
+			}
+			return;
+		}
+		holdingStart = 0;
+		currentUpdate++;
+	}, -1000);
+
+	const auto engineUpdateListener = controlThread().update.listen([]() {
+		if (!replaying)
+			return;
+		if (holding)
+		{
+			lastUpdateTime = 0;
+			return;
+		}
+		const uint64 now = applicationTime();
+		if (lastUpdateTime)
+			frameTimes.push_back(now - lastUpdateTime);
+		lastUpdateTime = now;
+		physicsTimes.push_back(physicsStatistics().updateTime);
+	});
+
+	const auto engineFinalizeListener = controlThread().finalize.listen([]() {
+		if (!recordPath.empty())
+			save();
+		if (replaying)
+		{
+			CAGE_LOG(SeverityEnum::Info, "replay", Stringizer() + "replayed " + currentFrame + " of " + frames.size() + " updates, held " + heldUpdates + " updates for terrain tiles");
+			const Real d = distance(playerPosition, finalPosition);
+			if (currentFrame != frames.size() || !(d < 1e-3))
+			{
+				CAGE_LOG(SeverityEnum::Error, "replay", Stringizer() + "replay diverged, final player position: " + playerPosition + ", recorded: " + finalPosition + ", distance: " + d);
+				diverged = true;
+			}
+			report("frame time", frameTimes);
+			report("tile latency", tileLatencies);
+			report("physics update", physicsTimes);
+		}
+	});
+}
+
+void replayInitialize(const String &recordPath_, const String &replayPath)
+{
+	if (!replayPath.empty())
+	{
+		load(replayPath);
+		replaying = true;
+		detail::randomGenerator().s[0] = seed[0];
+		detail::randomGenerator().s[1] = seed[1];
+		controlThread().updatePeriod(ReplayUpdatePeriod);
+		engineWindow()->setHidden(); // the engine still renders, but nothing waits for the presentation
+		CAGE_LOG(SeverityEnum::Info, "replay", Stringizer() + "replaying " + frames.size() + " updates from: " + replayPath);
+	}
+	else if (!recordPath_.empty())
+	{
+		recordPath = recordPath_;
+		seed[0] = detail::randomGenerator().s[0];
+		seed[1] = detail::randomGenerator().s[1];
+		updatePeriod = controlThread().updatePeriod();
+	}
+	else
+		return;
+	// the terrain generator takes its seed from the global random generator on first use, which must not happen in the generator threads
+	terrainOffset(Vec2());
+}
+
+void replayInput(Vec3 &cursor, bool &clinch)
+{
+	if (replaying)
+	{
+		if (currentFrame < frames.size())
+		{
+			const ReplayFrame &f = frames[currentFrame++];
+			cursor = f.cursor;
+			clinch = f.clinch;
+			if (currentFrame == frames.size())
+				engineStop();
+		}
+		else
+		{
+			cursor = Vec3::Nan();
+			clinch = false;
+		}
+	}
+	else if (!recordPath.empty())
+	{
+		ReplayFrame f;
+		f.cursor = cursor;
+		f.clinch = clinch;
+		frames.push_back(f);
+	}
+}
+
+void replayTileLatency(uint64 microseconds)
+{
+	if (replaying)
+		tileLatencies.push_back(microseconds);
+}
+
+void replayTileRegistered(const Vec2i &tile)
+{
+	if (!recordPath.empty())
+		tiles.push_back({ currentUpdate, tile });
+}
+
+bool replayTilesExpected(std::vector<Vec2i> &result)
+{
+	result.clear();
+	if (!replaying)
+		return false;
+	CAGE_ASSERT(!holding);
+	while (currentTile < tiles.size() && tiles[currentTile].first <= currentUpdate)
+	{
+		CAGE_ASSERT(tiles[currentTile].first == currentUpdate);
+		result.push_back(tiles[currentTile++].second);
+	}
+	return true;
+}
+
+bool replayDiverged()
+{
+	return diverged;
+}
+
+bool replayHolding()
+{
+	return holding;
+}
+
+uint64 gameUpdatePeriod()
+{
+	return replaying ? updatePeriod : controlThread().updatePeriod();
+}
@@ -0,0 +1,116 @@
+#include "common.h"
+
+#include <cage-core/entities.h>
+
+#include <cage-simple/engine.h>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+namespace
+{
+	// springs attached to each body, in no particular order
+	std::unordered_map<uint32, std::vector<Entity *>> bodiesSprings;
+
+	void attach(uint32 body, Entity *spring)
+	{
+		bodiesSprings[body].push_back(spring);
+	}
+
+	void detach(uint32 body, Entity *spring)
+	{
+		const auto it = bodiesSprings.find(body);
+		CAGE_ASSERT(it != bodiesSprings.end());
+		std::vector<Entity *> &v = it->second;
+		const auto s = std::find(v.begin(), v.end(), spring);
+		CAGE_ASSERT(s != v.end());
+		*s = v.back();
+		v.pop_back();
+		if (v.empty())
+			bodiesSprings.erase(it);
+	}
+
+	// a sleeping group does not notice a spring it lost
+	void wake(uint32 body)
+	{
+		Entity *e = engineEntities()->tryGet(body);
+		if (e && e->has<PhysicsComponent>())
+			e->value<PhysicsComponent>().wake = true;
+	}
+
+#ifdef CAGE_DEBUG
+	// detects springs created, retargeted or destroyed without going through the index
+	const auto engineUpdateListener = controlThread().update.listen([]() {
+		uint32 cnt = 0;
+		for (const auto &it : bodiesSprings)
+		{
+			for (Entity *e : it.second)
+			{
+				const SpringComponent &s = e->value<SpringComponent>();
+				CAGE_ASSERT(s.objects[0] == it.first || s.objects[1] == it.first);
+				cnt++;
+			}
+		}
+		CAGE_ASSERT(cnt == engineEntities()->component<SpringComponent>()->count() * 2);
+	});
+#endif // CAGE_DEBUG
+
+	const auto engineFinalizeListener = controlThread().finalize.listen([]() {
+		bodiesSprings.clear();
+	});
+}
+
+Entity *springCreate(uint32 a, uint32 b, Real restDistance, Real stiffness, Real damping)
+{
+	Entity *spring = engineEntities()->createUnique();
+	SpringComponent &s = spring->value<SpringComponent>();
+	s.objects[0] = a;
+	s.objects[1] = b;
+	s.restDistance = restDistance;
+	s.stiffness = stiffness;
+	s.damping = damping;
+	attach(a, spring);
+	attach(b, spring);
+	return spring;
+}
+
+void springRetarget(Entity *spring, uint32 end, uint32 body)
+{
+	CAGE_ASSERT(end < 2);
+	SpringComponent &s = spring->value<SpringComponent>();
+	if (s.objects[end] == body)
+		return;
+	detach(s.objects[end], spring);
+	wake(s.objects[end]);
+	s.objects[end] = body;
+	attach(body, spring);
+}
+
+void springDestroy(Entity *spring)
+{
+	const SpringComponent &s = spring->value<SpringComponent>();
+	detach(s.objects[0], spring);
+	detach(s.objects[1], spring);
+	wake(s.objects[0]);
+	wake(s.objects[1]);
+	spring->destroy();
+}
+
+void springsDestroy(uint32 body)
+{
+	const auto it = bodiesSprings.find(body);
+	if (it == bodiesSprings.end())
+		return;
+	const std::vector<Entity *> springs = it->second; // the destruction modifies the index
+	for (Entity *e : springs)
+		springDestroy(e);
+}
+
+PointerRange<Entity *const> springsOf(uint32 body)
+{
+	const auto it = bodiesSprings.find(body);
+	if (it == bodiesSprings.end())
+		return {};
+	return it->second;
+}
@@ -66,6 +66,7 @@ namespace
 	struct TileBase
 	{
 		Holder<Collider> cpuCollider;
+		Holder<TerrainHeights> cpuHeights;
 		Holder<Mesh> cpuMesh;
 		Holder<Model> gpuMesh;
 		Holder<Image> cpuAlbedo;
@@ -80,6 +81,8 @@ namespace
 		uint32 specialName = 0;
 		uint32 objectName = 0;
 		uint32 textureResolution = 0;
+		uint64 requestTime = 0;
+		bool registered = false; // the collider and heights are available to the physics
 
 		Real distanceToPlayer() const
 		{
@@ -103,6 +106,54 @@ namespace
 
 	void generatorEntry();
 
+	bool colliderGenerated(const Tile &t)
+	{
+		return !t.registered && (t.status == TileStateEnum::Upload || t.status == TileStateEnum::Entity);
+	}
+
+	void registerCollider(Tile &t)
+	{
+		addTerrainCollider(t.objectName, t.cpuCollider.share());
+		addTerrainHeights(t.objectName, std::move(t.cpuHeights));
+		t.registered = true;
+		replayTileRegistered(Vec2i(t.pos.x, t.pos.y));
+	}
+
+	Tile *findTile(const Vec2i &pos)
+	{
+		for (Tile &t : tiles)
+		{
+			if (t.status != TileStateEnum::Init && t.pos.x == pos[0] && t.pos.y == pos[1])
+				return &t;
+		}
+		return nullptr;
+	}
+
+	// colliders are registered independently of the rendering, as soon as the generator finishes them
+	// a replay holds the whole update until the same tiles as in the recording are generated, and registers only those
+	void registerColliders()
+	{
+		static std::vector<Vec2i> expected;
+		if (replayHolding())
+			return;
+		if (stopping || !replayTilesExpected(expected))
+		{
+			for (Tile &t : tiles)
+			{
+				if (colliderGenerated(t))
+					registerCollider(t);
+			}
+			return;
+		}
+		for (const Vec2i &pos : expected)
+		{
+			Tile *t = findTile(pos);
+			if (!t || !colliderGenerated(*t))
+				CAGE_THROW_ERROR(Exception, "replay diverged, terrain tile is missing"); // the replay checked the tiles before the update
+			registerCollider(*t);
+		}
+	}
+
 	/////////////////////////////////////////////////////////////////////////////
 	// CONTROL
 	/////////////////////////////////////////////////////////////////////////////
@@ -117,6 +168,7 @@ namespace
 	{
 		AssetManager *ass = engineAssets();
 		std::set<TilePos> neededTiles = stopping ? std::set<TilePos>() : findNeededTiles(tileLength, 200);
+		registerColliders();
 		for (Tile &t : tiles)
 		{
 			// mark unneeded tiles
@@ -131,17 +183,15 @@ namespace
 				ass->remove(t.specialName);
 				ass->remove(t.objectName);
 				removeTerrainCollider(t.objectName);
+				removeTerrainHeights(t.objectName);
 				t.entity->destroy();
 				(TileBase &)t = TileBase();
 				t.status = TileStateEnum::Init;
 			}
 
 			// create entity
-			else if (t.status == TileStateEnum::Entity)
+			else if (t.status == TileStateEnum::Entity && t.registered)
 			{
-				// register the collider
-				addTerrainCollider(t.objectName, t.cpuCollider.share());
-
 				{ // create the entity
 					t.entity = engineEntities()->createAnonymous();
 					TransformComponent &tr = t.entity->value<TransformComponent>();
@@ -151,6 +201,7 @@ namespace
 				}
 
 				t.status = TileStateEnum::Ready;
+				replayTileLatency(applicationTime() - t.requestTime);
 			}
 		}
 
@@ -162,6 +213,7 @@ namespace
 			if (t.status == TileStateEnum::Init)
 			{
 				t.pos = *neededTiles.begin();
+				t.requestTime = applicationTime();
 				neededTiles.erase(neededTiles.begin());
 				t.status = TileStateEnum::Generate;
 			}
@@ -291,9 +343,9 @@ namespace
 	void generateMesh(Tile &t)
 	{
 		constexpr Real pwoa = tileLength / (tileMeshResolution - 1);
-		constexpr Vec2 pwox = Vec2(pwoa, 0);
-		constexpr Vec2 pwoy = Vec2(0, pwoa);
+		std::vector<Vec2> worlds;
 		std::vector<Vec3> positions, normals;
+		worlds.reserve(tileMeshResolution * tileMeshResolution);
 		positions.reserve(tileMeshResolution * tileMeshResolution);
 		normals.reserve(tileMeshResolution * tileMeshResolution);
 		Transform l2w = t.l2w();
@@ -302,13 +354,31 @@ namespace
 			for (uint32 x = 0; x < tileMeshResolution; x++)
 			{
 				Vec2 pt = (Vec2(x, y) - 2) * tileLength / (tileMeshResolution - 5);
-				Vec2 pw = Vec2(l2w * Vec3(pt, 0));
-				Real z = terrainOffset(pw);
-				positions.push_back(Vec3(pt, z));
-				Real tox = terrainOffset(pw + pwox) - z;
-				Real toy = terrainOffset(pw + pwoy) - z;
-				normals.push_back(normalize(Vec3(-tox, -toy, 0.1)));
+				worlds.push_back(Vec2(l2w * Vec3(pt, 0)));
+				positions.push_back(Vec3(pt, 0));
+			}
+		}
+		{
+			std::vector<Real> heights(worlds.size());
+			std::vector<Vec2> gradients(worlds.size());
+			terrainOffset(worlds, heights, gradients);
+			for (uint32 i = 0; i < worlds.size(); i++)
+			{
+				positions[i][2] = heights[i];
+				// the gradient is scaled by the mesh spacing to keep the shading of the original finite differences
+				normals.push_back(normalize(Vec3(-gradients[i] * pwoa, 0.1)));
 			}
+			// the unsimplified grid is kept for physics
+			t.cpuHeights = systemMemory().createHolder<TerrainHeights>();
+			TerrainHeights &h = *t.cpuHeights;
+			h.origin = worlds[0];
+			h.spacing = tileLength / (tileMeshResolution - 5);
+			h.tileLength = tileLength;
+			h.tileX = t.pos.x;
+			h.tileY = t.pos.y;
+			h.resolution = tileMeshResolution;
+			h.heights = std::move(heights);
+			h.buildPyramid();
 		}
 		t.cpuMesh = newMesh();
 		t.cpuMesh->positions(positions);
@@ -341,13 +411,18 @@ namespace
 		t.cpuCollider->rebuild();
 	}
 
-	void textureGenerator(Tile *t, const Vec2i &xy, const Vec3i &idx, const Vec3 &weights)
+	struct TextureTexels
 	{
-		Vec3 p = t->cpuMesh->positionAt(idx, weights) * t->l2w();
-		Vec3 color; Real roughness; Real metallic;
-		terrainMaterial(Vec2(p), color, roughness, metallic, false);
-		t->cpuAlbedo->set(xy, color);
-		t->cpuSpecial->set(xy, Vec2(roughness, metallic));
+		Tile *tile = nullptr;
+		std::vector<Vec2i> xys;
+		std::vector<Vec2> positions;
+	};
+
+	void textureGenerator(TextureTexels *t, const Vec2i &xy, const Vec3i &idx, const Vec3 &weights)
+	{
+		Vec3 p = t->tile->cpuMesh->positionAt(idx, weights) * t->tile->l2w();
+		t->xys.push_back(xy);
+		t->positions.push_back(Vec2(p));
 	}
 
 	void generateTextures(Tile &t)
@@ -356,10 +431,27 @@ namespace
 		t.cpuAlbedo->initialize(t.textureResolution, t.textureResolution, 3);
 		t.cpuSpecial = newImage();
 		t.cpuSpecial->initialize(t.textureResolution, t.textureResolution, 2);
+
+		// collect all texels first and evaluate the materials in batches
+		TextureTexels texels;
+		texels.tile = &t;
+		texels.xys.reserve(t.textureResolution * t.textureResolution);
+		texels.positions.reserve(t.textureResolution * t.textureResolution);
 		MeshGenerateTextureConfig cfg;
-		cfg.generator.bind<Tile *, &textureGenerator>(&t);
+		cfg.generator.bind<TextureTexels *, &textureGenerator>(&texels);
 		cfg.width = cfg.height = t.textureResolution;
 		meshGenerateTexture(+t.cpuMesh, cfg);
+
+		const uint32 cnt = numeric_cast<uint32>(texels.positions.size());
+		std::vector<Vec3> colors(cnt);
+		std::vector<Real> roughness(cnt), metallic(cnt);
+		terrainMaterial(texels.positions, colors, roughness, metallic, false, 0.01);
+		for (uint32 i = 0; i < cnt; i++)
+		{
+			t.cpuAlbedo->set(texels.xys[i], colors[i]);
+			t.cpuSpecial->set(texels.xys[i], Vec2(roughness[i], metallic[i]));
+		}
+
 		imageDilation(+t.cpuAlbedo, 2);
 		imageDilation(+t.cpuSpecial, 2);
 		t.cpuSpecial->colorConfig.gammaSpace = GammaSpaceEnum::Linear;
@@ -405,3 +497,14 @@ namespace
 		}
 	}
 }
+
+bool terrainTilesGenerated(PointerRange<const Vec2i> positions)
+{
+	for (const Vec2i &pos : positions)
+	{
+		const Tile *t = findTile(pos);
+		if (!t || !colliderGenerated(*t))
+			return false;
+	}
+	return true;
+}
@@ -1,7 +1,6 @@
 #include "common.h"
 
 #include <cage-core/entities.h>
-#include <cage-core/hashString.h>
 #include <cage-core/color.h>
 
 #include <cage-engine/scene.h>
@@ -14,27 +13,6 @@
 SpringVisualComponent::SpringVisualComponent() : color(1, 1, 1)
 {}
 
-TimeoutComponent::TimeoutComponent() : ttl(0)
-{}
-
-Entity *newParticle(const Vec3 &position, const Vec3 &velocity, const Vec3 &color, Real mass, uint32 ttl)
-{
-	Entity *e = engineEntities()->createAnonymous();
-	TransformComponent &t = e->value<TransformComponent>();
-	RenderComponent &r = e->value<RenderComponent>();
-	PhysicsComponent &p = e->value<PhysicsComponent>();
-	TimeoutComponent &to = e->value<TimeoutComponent>();
-	t.position = position;
-	t.orientation = randomDirectionQuat();
-	r.color = color;
-	r.object = HashString("cragsman/particle/particle.object");
-	p.mass = mass;
-	p.velocity = velocity;
-	p.collisionRadius = Real::Nan();
-	to.ttl = ttl;
-	return e;
-}
-
 Vec3 colorDeviation(const Vec3 &color, Real deviation)
 {
 	Vec3 hsv = colorRgbToHsv(color) + (Vec3(randomChance(), randomChance(), randomChance()) - 0.5) * deviation;
@@ -55,18 +33,8 @@ namespace
 	}
 
 	const auto engineUpdateListener = controlThread().update.listen([]() {
-		{ // timeout entities
-			std::vector<Entity *> etd;
-			for (Entity *e : engineEntities()->component<TimeoutComponent>()->entities())
-			{
-				TimeoutComponent &t = e->value<TimeoutComponent>();
-				if (t.ttl-- == 0)
-					etd.push_back(e);
-			}
-			for (Entity *e : etd)
-				e->destroy();
-		}
-
+		if (replayHolding())
+			return;
 		{ // spring visuals
 			for (Entity *e : engineEntities()->component<SpringVisualComponent>()->entities())
 			{
@@ -91,17 +59,9 @@ namespace
 					Real deviation = sin(Rads::Full() * 0.5 * Real(i) / cnt);
 					Real portion = (randomChance() + i) / cnt;
 					Vec3 color = colorDeviation(v.color, 0.1);
-					Entity *pe = newParticle(
-						interpolate(t0.position, t1.position, portion) + randomDirection3() * deviation * 1.5,
-						interpolate(v0, v1, portion) + randomDirection3() * deviation * 5,
-						color, 0.05, 5);
-					if (randomChance() < 0.2)
-					{
-						LightComponent &pl = pe->value<LightComponent>();
-						pl.color = color;
-						pl.intensity = 1.5;
-						pl.attenuation = Vec3(0, 0, 0.15);
-					}
+					const Vec3 position = interpolate(t0.position, t1.position, portion) + randomDirection3() * deviation * 1.5;
+					const Vec3 velocity = interpolate(v0, v1, portion) + randomDirection3() * deviation * 5;
+					particlesEmit(position, velocity, color, 5, randomChance() < 0.2);
 				}
 			}
 		}
@@ -109,6 +69,5 @@ namespace
 
 	const auto engineInitListener = controlThread().initialize.listen([]() {
 		engineEntities()->defineComponent(SpringVisualComponent());
-		engineEntities()->defineComponent(TimeoutComponent());
 	});
 }